@@ -27,6 +27,9 @@
 #include "include/gverbdsp.h"
 #include "include/gverb.h"
 #include "include/ladspa-util.h"
+#if GVERB_PSRAM
+#include "../parrot.h"
+#endif
 
 ty_gverb *gverb_new(int srate, float maxroomsize, float roomsize,
 		    float revtime,
@@ -35,14 +38,88 @@ ty_gverb *gverb_new(int srate, float maxroomsize, float roomsize,
 		    float taillevel)
 {
   ty_gverb *p;
-  float ga,gb,gt;
-  int i,n;
+  float gb;
+  int i;
   float r;
   float diffscale;
   int a,b,c,cc,d,dd,e;
   float spread1,spread2;
+  float maxdelay,largestdelay,diffdelay;
+  int fdnsize,tapsize,total;
+  int lsizes[4],rsizes[4];
+  float *mem;
+
+  /* Work out the size of every buffer first, so that the whole
+   * reverb can be made with a single allocation */
+
+  if (roomsize > maxroomsize) roomsize = maxroomsize;
+  maxdelay = srate*maxroomsize/340.0f;
+  largestdelay = srate*roomsize/340.0f;
+
+  /* The longest FDN read is fdnlens[0] = largestdelay, and the longest
+   * tap is taps[0] = 5+0.410*largestdelay, so size both from the largest
+   * room. The +2 covers rounding in gverb_set_roomsize. gverb_do_block
+   * writes a whole block to the tap delay before reading the taps, so
+   * that needs room for one more block. */
+  fdnsize = next_pow2((int)maxdelay+2);
+  tapsize = next_pow2(5+(int)(0.410f*maxdelay)+2+GVERB_MAXBLOCK);
+#if GVERB_PSRAM
+  if ((FDNORDER*fdnsize + tapsize)*sizeof(float) > GVERB_PSRAM_SIZE) return(NULL);
+#endif
+
+  diffdelay = largestdelay;
+#if GVERB_PSRAM
+  if (roomsize > GVERB_DIFFUSER_MAXROOM) diffdelay = srate*GVERB_DIFFUSER_MAXROOM/340.0f;
+#endif
+  diffscale = (float)f_round(0.632450f*diffdelay)/(210+159+562+410);
+  spread1 = spread;
+  spread2 = 3.0f*spread;
+
+  b = 210;
+  r = 0.125541f;
+  a = spread1*r;
+  c = 210+159+a;
+  cc = c-b;
+  r = 0.854046f;
+  a = spread2*r;
+  d = 210+159+562+a;
+  dd = d-c;
+  e = 1341-d;
+
+  lsizes[0] = (int)(diffscale*b);
+  lsizes[1] = (int)(diffscale*cc);
+  lsizes[2] = (int)(diffscale*dd);
+  lsizes[3] = (int)(diffscale*e);
+
+  b = 210;
+  r = -0.568366f;
+  a = spread1*r;
+  c = 210+159+a;
+  cc = c-b;
+  r = -0.126815f;
+  a = spread2*r;
+  d = 210+159+562+a;
+  dd = d-c;
+  e = 1341-d;
+
+  rsizes[0] = (int)(diffscale*b);
+  rsizes[1] = (int)(diffscale*cc);
+  rsizes[2] = (int)(diffscale*dd);
+  rsizes[3] = (int)(diffscale*e);
+
+#if GVERB_PSRAM
+  total = 0;
+#else
+  total = FDNORDER*fdnsize + tapsize;
+#endif
+  for(i = 0; i < 4; i++) {
+    total += next_pow2(lsizes[i]) + next_pow2(rsizes[i]);
+  }
+
+  p = (ty_gverb *)malloc(sizeof(ty_gverb) + total*sizeof(float));
+  if (p == NULL) return(NULL);
+  mem = (float *)(p + 1);
 
-  p = (ty_gverb *)malloc(sizeof(ty_gverb));
   p->rate = srate;
   p->fdndamping = damping;
   p->maxroomsize = maxroomsize;
@@ -51,134 +128,247 @@ ty_gverb *gverb_new(int srate, float maxroomsize, float roomsize,
   p->earlylevel = earlylevel;
   p->taillevel = taillevel;
 
-  p->maxdelay = p->rate*p->maxroomsize/340.0;
-  p->largestdelay = p->rate*p->roomsize/340.0;
+  p->maxdelay = maxdelay;
+  p->largestdelay = largestdelay;
 
 
   /* Input damper */
 
   p->inputbandwidth = inputbandwidth;
-  p->inputdamper = damper_make(1.0 - p->inputbandwidth);
+  damper_init(&p->inputdamper, 1.0f - p->inputbandwidth);
 
 
   /* FDN section */
-  p->fdndels = (ty_fixeddelay **)calloc(FDNORDER, sizeof(ty_fixeddelay *));
-  for(i = 0; i < FDNORDER; i++) {
-    p->fdndels[i] = fixeddelay_make((int)p->maxdelay+1000);
-  }
-  p->fdngains = (float *)calloc(FDNORDER, sizeof(float));
-  p->fdnlens = (int *)calloc(FDNORDER, sizeof(int));
-  p->fdndamps = (ty_damper **)calloc(FDNORDER, sizeof(ty_damper *));
+  p->fdnsize = fdnsize;
+  p->fdnmask = fdnsize - 1;
+  p->fdnidx = 0;
+#if GVERB_PSRAM
+  p->fdnbase = GVERB_PSRAM_BASE;
+  p->tapbase = GVERB_PSRAM_BASE + FDNORDER*fdnsize*sizeof(float);
+#else
+  p->fdnbuf = mem;
+  memset(p->fdnbuf, 0, FDNORDER*fdnsize*sizeof(float));
+  mem += FDNORDER*fdnsize;
+#endif
   for(i = 0; i < FDNORDER; i++) {
-    p->fdndamps[i] = damper_make(p->fdndamping);
+    p->fdndampdelay[i] = 0.0f;
   }
 
-  ga = 60.0;
-  gt = p->revtime;
-  ga = powf(10.0f,-ga/20.0f);
-  n = p->rate*gt;
-  p->alpha = pow((double)ga, 1.0/(double)n);
+  p->alphalog2 = gverb_alphalog2(p->rate, p->revtime);
 
-  gb = 0.0;
+  gb = 0.0f;
   for(i = 0; i < FDNORDER; i++) {
-    if (i == 0) gb = 1.000000*p->largestdelay;
-    if (i == 1) gb = 0.816490*p->largestdelay;
-    if (i == 2) gb = 0.707100*p->largestdelay;
-    if (i == 3) gb = 0.632450*p->largestdelay;
+    if (i == 0) gb = 1.000000f*p->largestdelay;
+    if (i == 1) gb = 0.816490f*p->largestdelay;
+    if (i == 2) gb = 0.707100f*p->largestdelay;
+    if (i == 3) gb = 0.632450f*p->largestdelay;
 
 #if 0
     p->fdnlens[i] = nearest_prime((int)gb, 0.5);
 #else
     p->fdnlens[i] = f_round(gb);
 #endif
-    p->fdngains[i] = -powf((float)p->alpha,p->fdnlens[i]);
+    p->fdngains[i] = -gverb_decay(p->alphalog2, p->fdnlens[i]);
   }
 
-  p->d = (float *)calloc(FDNORDER, sizeof(float));
-  p->u = (float *)calloc(FDNORDER, sizeof(float));
-  p->f = (float *)calloc(FDNORDER, sizeof(float));
+  memset(p->d, 0, FDNORDER * sizeof(float));
+  memset(p->u, 0, FDNORDER * sizeof(float));
+  memset(p->f, 0, FDNORDER * sizeof(float));
 
   /* Diffuser section */
 
-  diffscale = (float)p->fdnlens[3]/(210+159+562+410);
-  spread1 = spread;
-  spread2 = 3.0*spread;
+  for(i = 0; i < 4; i++) {
+    diffuser_init(&p->ldifs[i],lsizes[i],(i < 2) ? 0.75f : 0.625f,mem);
+    mem += next_pow2(lsizes[i]);
+    diffuser_init(&p->rdifs[i],rsizes[i],(i < 2) ? 0.75f : 0.625f,mem);
+    mem += next_pow2(rsizes[i]);
+  }
 
-  b = 210;
-  r = 0.125541;
-  a = spread1*r;
-  c = 210+159+a;
-  cc = c-b;
-  r = 0.854046;
-  a = spread2*r;
-  d = 210+159+562+a;
-  dd = d-c;
-  e = 1341-d;
 
-  p->ldifs = (ty_diffuser **)calloc(4, sizeof(ty_diffuser *));
-  p->ldifs[0] = diffuser_make((int)(diffscale*b),0.75);
-  p->ldifs[1] = diffuser_make((int)(diffscale*cc),0.75);
-  p->ldifs[2] = diffuser_make((int)(diffscale*dd),0.625);
-  p->ldifs[3] = diffuser_make((int)(diffscale*e),0.625);
+  /* Tapped delay section */
 
-  b = 210;
-  r = -0.568366;
-  a = spread1*r;
-  c = 210+159+a;
-  cc = c-b;
-  r = -0.126815;
-  a = spread2*r;
-  d = 210+159+562+a;
-  dd = d-c;
-  e = 1341-d;
+#if GVERB_PSRAM
+  /* only the size and index are used, the line itself is in PSRAM */
+  fixeddelay_init(&p->tapdelay,tapsize,NULL);
+#else
+  fixeddelay_init(&p->tapdelay,tapsize,mem);
+#endif
+  p->taps[0] = 5+0.410f*p->largestdelay;
+  p->taps[1] = 5+0.300f*p->largestdelay;
+  p->taps[2] = 5+0.155f*p->largestdelay;
+  p->taps[3] = 5+0.000f*p->largestdelay;
 
-  p->rdifs = (ty_diffuser **)calloc(4, sizeof(ty_diffuser *));
-  p->rdifs[0] = diffuser_make((int)(diffscale*b),0.75);
-  p->rdifs[1] = diffuser_make((int)(diffscale*cc),0.75);
-  p->rdifs[2] = diffuser_make((int)(diffscale*dd),0.625);
-  p->rdifs[3] = diffuser_make((int)(diffscale*e),0.625);
+  for(i = 0; i < FDNORDER; i++) {
+    p->tapgains[i] = gverb_decay(p->alphalog2, p->taps[i]);
+  }
+#if GVERB_PSRAM
+  gverb_flush(p);
+#endif
+  return(p);
+}
 
+/*
+ * Scratch buffers for gverb_do_block. These are static rather than on the
+ * stack, as the audio callback runs with very little stack.
+ */
+static float gv_x[GVERB_MAXBLOCK];
+static float gv_z[GVERB_MAXBLOCK];
+static float gv_sum[GVERB_MAXBLOCK];
+static float gv_u[FDNORDER][GVERB_MAXBLOCK];
+static float gv_fdn[FDNORDER][GVERB_MAXBLOCK];
 
+/*
+ * Block access to the FDN and tap delay lines, which are either rings in
+ * SRAM or streamed to and from PSRAM in bursts
+ */
+#if GVERB_PSRAM
+static __inline void gverb_fdn_read(const ty_gverb *p, int line, int start, float *dst, int n)
+{
+  psram_ring_read(p->fdnbase + line*p->fdnsize*sizeof(float), p->fdnsize,
+                  start & p->fdnmask, dst, n);
+}
 
-  /* Tapped delay section */
+static __inline void gverb_fdn_write(const ty_gverb *p, int line, int start, const float *src, int n)
+{
+  psram_ring_write(p->fdnbase + line*p->fdnsize*sizeof(float), p->fdnsize,
+                   start & p->fdnmask, src, n);
+}
 
-  p->tapdelay = fixeddelay_make(48000);
-  p->taps = (int *)calloc(FDNORDER, sizeof(int));
-  p->tapgains = (float *)calloc(FDNORDER, sizeof(float));
-  p->taps[0] = 5+0.410*p->largestdelay;
-  p->taps[1] = 5+0.300*p->largestdelay;
-  p->taps[2] = 5+0.155*p->largestdelay;
-  p->taps[3] = 5+0.000*p->largestdelay;
+static __inline void gverb_tap_read(const ty_gverb *p, int delay, float *dst, int n)
+{
+  psram_ring_read(p->tapbase, p->tapdelay.size,
+                  (p->tapdelay.idx - delay) & p->tapdelay.mask, dst, n);
+}
 
-  for(i = 0; i < FDNORDER; i++) {
-    p->tapgains[i] = pow(p->alpha,(double)p->taps[i]);
-  }
-  return(p);
+static __inline void gverb_tap_write(ty_gverb *p, const float *src, int n)
+{
+  psram_ring_write(p->tapbase, p->tapdelay.size, p->tapdelay.idx, src, n);
+  p->tapdelay.idx = (p->tapdelay.idx + n) & p->tapdelay.mask;
+}
+#else
+static __inline void gverb_fdn_read(const ty_gverb *p, int line, int start, float *dst, int n)
+{
+  ring_read_block(p->fdnbuf + line*p->fdnsize, p->fdnmask, start, dst, n);
 }
 
-void gverb_free(ty_gverb *p)
+static __inline void gverb_fdn_write(const ty_gverb *p, int line, int start, const float *src, int n)
 {
-  int i;
+  ring_write_block(p->fdnbuf + line*p->fdnsize, p->fdnmask, start, src, n);
+}
+
+static __inline void gverb_tap_read(const ty_gverb *p, int delay, float *dst, int n)
+{
+  fixeddelay_read_block(&p->tapdelay, delay, dst, n);
+}
+
+static __inline void gverb_tap_write(ty_gverb *p, const float *src, int n)
+{
+  fixeddelay_write_block(&p->tapdelay, src, n);
+}
+#endif
+
+/*
+ * Process a block of n samples. The result is identical to calling
+ * gverb_do n times, but each stage runs over the whole block: the taps
+ * and FDN lines are fetched as contiguous segments and scaled with
+ * CMSIS-DSP, and the damper and matrix recursion keeps its state in
+ * locals rather than in the struct.
+ */
+static void gverb_do_chunk(ty_gverb *p, const float *x, float *yl, float *yr, int n)
+{
+  const float damping = p->fdndamping;
+  const float undamping = 1.0f - p->fdndamping;
+  const float taillevel = p->taillevel;
+  const float earlylevel = p->earlylevel;
+  float s0 = p->fdndampdelay[0], s1 = p->fdndampdelay[1];
+  float s2 = p->fdndampdelay[2], s3 = p->fdndampdelay[3];
+  int i,k;
+
+  /* Input damper and first diffuser, into the tap delay */
+  for(k = 0; k < n; k++) {
+    float xk = x[k];
+
+    if ((xk != xk) || fabsf(xk) > 100000.0f) {
+      xk = 0.0f;
+    }
+    gv_x[k] = xk;
+    gv_z[k] = diffuser_do(&p->ldifs[0], damper_do(&p->inputdamper, xk));
+  }
+  gverb_tap_write(p, gv_z, n);
+
+  /* Every tap is at least 5 samples, so it only ever reads samples that
+   * were written before the one it is mixed with */
+  for(i = 0; i < FDNORDER; i++) {
+    gverb_tap_read(p, p->taps[i] + n, gv_u[i], n);
+    arm_scale_f32(gv_u[i], p->tapgains[i], gv_u[i], n);
+    gverb_fdn_read(p, i, p->fdnidx - p->fdnlens[i], gv_fdn[i], n);
+    arm_scale_f32(gv_fdn[i], p->fdngains[i], gv_fdn[i], n);
+  }
+
+  /* Damping, output sum and feedback matrix. The FDN input for this
+   * block overwrites the line contents that have just been used. */
+  for(k = 0; k < n; k++) {
+    const float u0 = gv_u[0][k], u1 = gv_u[1][k];
+    const float u2 = gv_u[2][k], u3 = gv_u[3][k];
+    float sum;
+
+    s0 = gv_fdn[0][k]*undamping + s0*damping;
+    s1 = gv_fdn[1][k]*undamping + s1*damping;
+    s2 = gv_fdn[2][k]*undamping + s2*damping;
+    s3 = gv_fdn[3][k]*undamping + s3*damping;
+
+    sum = 0.0f;
+    sum += taillevel*s0 + earlylevel*u0;
+    sum += -(taillevel*s1 + earlylevel*u1);
+    sum += taillevel*s2 + earlylevel*u2;
+    sum += -(taillevel*s3 + earlylevel*u3);
+    sum += gv_x[k]*earlylevel;
+    gv_sum[k] = sum;
+
+    gv_fdn[0][k] = u0 + 0.5f*(+s0 + s1 - s2 - s3);
+    gv_fdn[1][k] = u1 + 0.5f*(+s0 - s1 - s2 + s3);
+    gv_fdn[2][k] = u2 + 0.5f*(-s0 + s1 - s2 + s3);
+    gv_fdn[3][k] = u3 + 0.5f*(+s0 + s1 + s2 + s3);
+  }
+  p->fdndampdelay[0] = s0;
+  p->fdndampdelay[1] = s1;
+  p->fdndampdelay[2] = s2;
+  p->fdndampdelay[3] = s3;
 
-  damper_free(p->inputdamper);
   for(i = 0; i < FDNORDER; i++) {
-    fixeddelay_free(p->fdndels[i]);
-    damper_free(p->fdndamps[i]);
-    diffuser_free(p->ldifs[i]);
-    diffuser_free(p->rdifs[i]);
+    gverb_fdn_write(p, i, p->fdnidx, gv_fdn[i], n);
+  }
+  p->fdnidx = (p->fdnidx + n) & p->fdnmask;
+
+  /* Output diffusers, one stage at a time over the block */
+  arm_copy_f32(gv_sum, yl, n);
+  arm_copy_f32(gv_sum, yr, n);
+  for(i = 1; i < 4; i++) {
+    for(k = 0; k < n; k++) {
+      yl[k] = diffuser_do(&p->ldifs[i], yl[k]);
+    }
+    for(k = 0; k < n; k++) {
+      yr[k] = diffuser_do(&p->rdifs[i], yr[k]);
+    }
   }
-  free(p->fdndels);
-  free(p->fdngains);
-  free(p->fdnlens);
-  free(p->fdndamps);
-  free(p->d);
-  free(p->u);
-  free(p->f);
-  free(p->ldifs);
-  free(p->rdifs);
-  free(p->taps);
-  free(p->tapgains);
-  fixeddelay_free(p->tapdelay);
+}
+
+void gverb_do_block(ty_gverb *p, const float *x, float *yl, float *yr, int n)
+{
+  while (n > 0) {
+    int len = (n < GVERB_MAXBLOCK) ? n : GVERB_MAXBLOCK;
+
+    gverb_do_chunk(p, x, yl, yr, len);
+    x += len;
+    yl += len;
+    yr += len;
+    n -= len;
+  }
+}
+
+void gverb_free(ty_gverb *p)
+{
+  /* The buffers are part of the same allocation */
   free(p);
 }
 
@@ -186,17 +376,28 @@ void gverb_flush(ty_gverb *p)
 {
   int i;
 
-  damper_flush(p->inputdamper);
+  damper_flush(&p->inputdamper);
+#if GVERB_PSRAM
+  /* zero the PSRAM lines a scratch block at a time */
+  memset(gv_z, 0, sizeof(gv_z));
+  for(i = 0; i < FDNORDER*p->fdnsize; i += GVERB_MAXBLOCK) {
+    psram_burst_write(p->fdnbase + i*sizeof(float), gv_z, sizeof(gv_z));
+  }
+  for(i = 0; i < p->tapdelay.size; i += GVERB_MAXBLOCK) {
+    psram_burst_write(p->tapbase + i*sizeof(float), gv_z, sizeof(gv_z));
+  }
+#else
+  memset(p->fdnbuf, 0, FDNORDER * p->fdnsize * sizeof(float));
+#endif
   for(i = 0; i < FDNORDER; i++) {
-    fixeddelay_flush(p->fdndels[i]);
-    damper_flush(p->fdndamps[i]);
-    diffuser_flush(p->ldifs[i]);
-    diffuser_flush(p->rdifs[i]);
+    p->fdndampdelay[i] = 0.0f;
+    diffuser_flush(&p->ldifs[i]);
+    diffuser_flush(&p->rdifs[i]);
   }
   memset(p->d, 0, FDNORDER * sizeof(float));
   memset(p->u, 0, FDNORDER * sizeof(float));
   memset(p->f, 0, FDNORDER * sizeof(float));
-  fixeddelay_flush(p->tapdelay);
+  fixeddelay_flush(&p->tapdelay);
 }
 
 /* swh: other functions are now in the .h file for inlining */
@@ -31,44 +31,30 @@
 #define TRUE 1
 #define FALSE 0
 
-ty_diffuser *diffuser_make(int size, float coeff)
-{
-  ty_diffuser *p;
-  int i;
+/* The buffers are carved out of the single gverb allocation by gverb_new,
+ * so these only initialise the state around them. A diffuser buffer must
+ * hold next_pow2(size) samples, a fixed delay buffer size samples, where
+ * size is a power of two. */
 
-  p = (ty_diffuser *)malloc(sizeof(ty_diffuser));
+void diffuser_init(ty_diffuser *p, int size, float coeff, float *buf)
+{
   p->size = size;
+  p->mask = next_pow2(size) - 1;
   p->coeff = coeff;
   p->idx = 0;
-  p->buf = (float *)malloc(size*sizeof(float));
-  for (i = 0; i < size; i++) p->buf[i] = 0.0;
-  return(p);
-}
-
-void diffuser_free(ty_diffuser *p)
-{
-  free(p->buf);
-  free(p);
+  p->buf = buf;
+  diffuser_flush(p);
 }
 
 void diffuser_flush(ty_diffuser *p)
 {
-  memset(p->buf, 0, p->size * sizeof(float));
+  memset(p->buf, 0, (p->mask + 1) * sizeof(float));
 }
 
-ty_damper *damper_make(float damping)
+void damper_init(ty_damper *p, float damping)
 {
-  ty_damper *p;
-
-  p = (ty_damper *)malloc(sizeof(ty_damper));
   p->damping = damping;
   p->delay = 0.0f;
-  return(p);
-}
-
-void damper_free(ty_damper *p)
-{
-  free(p);
 }
 
 void damper_flush(ty_damper *p)
@@ -76,28 +62,29 @@ void damper_flush(ty_damper *p)
   p->delay = 0.0f;
 }
 
-ty_fixeddelay *fixeddelay_make(int size)
+void fixeddelay_init(ty_fixeddelay *p, int size, float *buf)
 {
-  ty_fixeddelay *p;
-  int i;
-
-  p = (ty_fixeddelay *)malloc(sizeof(ty_fixeddelay));
   p->size = size;
+  p->mask = size - 1;
   p->idx = 0;
-  p->buf = (float *)malloc(size*sizeof(float));
-  for (i = 0; i < size; i++) p->buf[i] = 0.0;
-  return(p);
+  p->buf = buf;
+  fixeddelay_flush(p);
 }
 
-void fixeddelay_free(ty_fixeddelay *p)
+void fixeddelay_flush(ty_fixeddelay *p)
 {
-  free(p->buf);
-  free(p);
+  /* buf is NULL when the line is kept elsewhere (e.g. in PSRAM) */
+  if (p->buf != NULL) {
+    memset(p->buf, 0, p->size * sizeof(float));
+  }
 }
 
-void fixeddelay_flush(ty_fixeddelay *p)
+int next_pow2(int n)
 {
-  memset(p->buf, 0, p->size * sizeof(float));
+  int p = 1;
+
+  while (p < n) p <<= 1;
+  return(p);
 }
 
 int isprime(int n)
@@ -31,40 +31,93 @@
 
 #define FDNORDER 4
 
+/*
+ * Where the FDN and tap delay lines live. With GVERB_PSRAM=1 they are kept
+ * in PSRAM from GVERB_PSRAM_BASE (above the pverb lines) and streamed a
+ * block at a time by gverb_do_block, which allows far larger rooms for no
+ * extra SRAM. The short diffusers stay in SRAM, and are capped at the size
+ * they have in a GVERB_DIFFUSER_MAXROOM room. The per-sample gverb_do is
+ * only available with the lines in SRAM.
+ */
+#ifndef GVERB_PSRAM
+#define GVERB_PSRAM 0
+#endif
+
+#if GVERB_PSRAM
+#define GVERB_PSRAM_BASE       0x500000
+#define GVERB_PSRAM_SIZE       0x300000   /* to the end of the 8MB PSRAM */
+#define GVERB_MAXROOMSIZE      300.0f
+#define GVERB_ROOMSIZE         200.0f
+#define GVERB_MAXREVTIME       60.0f
+#define GVERB_DIFFUSER_MAXROOM 40.0f
+#else
+#define GVERB_MAXROOMSIZE      58.0f
+#define GVERB_ROOMSIZE         40.0f
+#define GVERB_MAXREVTIME       10.0f
+#endif
+
+/* Largest block handled in one pass by gverb_do_block. The FDN lines are
+ * read a block at a time, so this must not exceed the shortest FDN length
+ * (0.63245 * 141 = 89 samples at 48kHz for the smallest room). Longer
+ * blocks are split. */
+#define GVERB_MAXBLOCK 64
+
+/*
+ * All of the gverb state lives in a single allocation made by gverb_new.
+ * The four FDN lines are stored back to back in fdnbuf and, as they are all
+ * written once per sample, share a single write index. Their gains, lengths
+ * and damper states are held as arrays alongside, rather than as separately
+ * allocated objects reached through pointer arrays.
+ */
 typedef struct {
   int rate;
   float inputbandwidth;
   float taillevel;
   float earlylevel;
-  ty_damper *inputdamper;
+  ty_damper inputdamper;
   float maxroomsize;
   float roomsize;
   float revtime;
   float maxdelay;
   float largestdelay;
-  ty_fixeddelay **fdndels;
-  float *fdngains;
-  int *fdnlens;
-  ty_damper **fdndamps; 
+#if GVERB_PSRAM
+  uint32_t fdnbase;               /* PSRAM address of FDNORDER lines of fdnsize samples */
+  uint32_t tapbase;               /* PSRAM address of the tap delay line */
+#else
+  float *fdnbuf;                  /* FDNORDER lines of fdnsize samples */
+#endif
+  int fdnsize;                    /* a power of two */
+  int fdnmask;
+  int fdnidx;
+  float fdngains[FDNORDER];
+  int fdnlens[FDNORDER];
   float fdndamping;
-  ty_diffuser **ldifs;
-  ty_diffuser **rdifs;
-  ty_fixeddelay *tapdelay;
-  int *taps;
-  float *tapgains;
-  float *d;
-  float *u;
-  float *f;
-  double alpha;
+  float fdndampdelay[FDNORDER];   /* FDN damper states */
+  ty_diffuser ldifs[4];
+  ty_diffuser rdifs[4];
+  ty_fixeddelay tapdelay;
+  int taps[FDNORDER];
+  float tapgains[FDNORDER];
+  float d[FDNORDER];
+  float u[FDNORDER];
+  float f[FDNORDER];
+  float alphalog2;                /* log2 of the per-sample decay */
 } ty_gverb;
 
 
 ty_gverb *gverb_new(int, float, float, float, float, float, float, float, float);
 void gverb_free(ty_gverb *);
 void gverb_flush(ty_gverb *);
+#if !GVERB_PSRAM
 static void gverb_do(ty_gverb *, float, float *, float *);
+#endif
+void gverb_do_block(ty_gverb *, const float *, float *, float *, int);
 static void gverb_set_roomsize(ty_gverb *, float);
 static void gverb_set_revtime(ty_gverb *, float);
+static float gverb_alphalog2(int, float);
+static float gverb_decay(float, int);
+static float gverb_calc_revtime(const ty_gverb *, float, float *);
+static void gverb_apply_revtime(ty_gverb *, float, float, const float *);
 static void gverb_set_damping(ty_gverb *, float);
 static void gverb_set_inputbandwidth(ty_gverb *, float);
 static void gverb_set_earlylevel(ty_gverb *, float);
@@ -103,6 +156,7 @@ static __inline void gverb_fdnmatrix(float *a, float *b)
   b[3] = 0.5f*(+dl0 + dl1 + dl2 + dl3);
 }
 
+#if !GVERB_PSRAM
 static __inline void gverb_do(ty_gverb *p, float x, float *yl, float *yr)
 {
   float z;
@@ -113,19 +167,22 @@ static __inline void gverb_do(ty_gverb *p, float x, float *yl, float *yr)
     x = 0.0f;
   }
 
-  z = damper_do(p->inputdamper, x);
+  z = damper_do(&p->inputdamper, x);
 
-  z = diffuser_do(p->ldifs[0],z);
+  z = diffuser_do(&p->ldifs[0],z);
 
   for(i = 0; i < FDNORDER; i++) {
-    p->u[i] = p->tapgains[i]*fixeddelay_read(p->tapdelay,p->taps[i]);
+    p->u[i] = p->tapgains[i]*fixeddelay_read(&p->tapdelay,p->taps[i]);
   }
-  fixeddelay_write(p->tapdelay,z);
+  fixeddelay_write(&p->tapdelay,z);
 
   for(i = 0; i < FDNORDER; i++) {
-    p->d[i] = damper_do(p->fdndamps[i],
-			p->fdngains[i]*fixeddelay_read(p->fdndels[i],
-						       p->fdnlens[i]));
+    const float *line = p->fdnbuf + i*p->fdnsize;
+    float y = p->fdngains[i]*line[(p->fdnidx - p->fdnlens[i]) & p->fdnmask];
+
+    y = y*(1.0f-p->fdndamping) + p->fdndampdelay[i]*p->fdndamping;
+    p->fdndampdelay[i] = y;
+    p->d[i] = y;
   }
 
   sum = 0.0f;
@@ -141,26 +198,64 @@ static __inline void gverb_do(ty_gverb *p, float x, float *yl, float *yr)
   gverb_fdnmatrix(p->d,p->f);
 
   for(i = 0; i < FDNORDER; i++) {
-    fixeddelay_write(p->fdndels[i],p->u[i]+p->f[i]);
+    p->fdnbuf[i*p->fdnsize + p->fdnidx] = p->u[i]+p->f[i];
   }
+  p->fdnidx = (p->fdnidx + 1) & p->fdnmask;
 
-  lsum = diffuser_do(p->ldifs[1],lsum);
-  lsum = diffuser_do(p->ldifs[2],lsum);
-  lsum = diffuser_do(p->ldifs[3],lsum);
-  rsum = diffuser_do(p->rdifs[1],rsum);
-  rsum = diffuser_do(p->rdifs[2],rsum);
-  rsum = diffuser_do(p->rdifs[3],rsum);
+  lsum = diffuser_do(&p->ldifs[1],lsum);
+  lsum = diffuser_do(&p->ldifs[2],lsum);
+  lsum = diffuser_do(&p->ldifs[3],lsum);
+  rsum = diffuser_do(&p->rdifs[1],rsum);
+  rsum = diffuser_do(&p->rdifs[2],rsum);
+  rsum = diffuser_do(&p->rdifs[3],rsum);
 
   *yl = lsum;
   *yr = rsum;
 }
+#endif
+
+/*
+ * The coefficient math is all single precision, as the M33 FPU has no
+ * double support. Rather than keep alpha (the per-sample decay) and raise
+ * it to each delay length with pow(), we keep log2(alpha) and use the
+ * f_pow2() approximation from ladspa-util.h:
+ *
+ *   alpha^n = 2^(n * log2(alpha)),  log2(alpha) = log2(10^-3) / (rate * revtime)
+ *
+ * f_pow2() is within 1.5e-4 (relative) of exp2f() for exponents from -126
+ * to 0, so each gain is within 1.5e-4 of the double result. In an FDN line
+ * that puts the decay time within 1.5e-4 / |ln(gain)| of the target: under
+ * 0.3% with the 40m room used here, for any revtime up to 10s. Exponents
+ * below -126 would go denormal (or wrap the exponent field) and are
+ * returned as zero.
+ */
+#define GVERB_LOG2_T60 -9.965784f     /* log2(10^-3), i.e. -60dB */
+
+static __inline float gverb_alphalog2(int rate, float revtime)
+{
+  /* a revtime of zero gives no tail at all */
+  if (revtime <= 0.0f) {
+    return(-INFINITY);
+  }
+  return(GVERB_LOG2_T60/((float)rate*revtime));
+}
+
+static __inline float gverb_decay(float alphalog2, int n)
+{
+  const float x = alphalog2*(float)n;
+
+  return((x < -126.0f) ? 0.0f : f_pow2(x));
+}
 
 static __inline void gverb_set_roomsize(ty_gverb *p, const float a)
 {
   unsigned int i;
 
-    if (a <= 1.0 || (a != a)) {
-    p->roomsize = 1.0;
+    if (a <= 1.0f || (a != a)) {
+    p->roomsize = 1.0f;
+  } else if (a > p->maxroomsize) {
+    /* the delay lines are only sized for the largest room */
+    p->roomsize = p->maxroomsize;
   } else {
     p->roomsize = a;
   }
@@ -171,7 +266,7 @@ static __inline void gverb_set_roomsize(ty_gverb *p, const float a)
   p->fdnlens[2] = f_round(0.707100f*p->largestdelay);
   p->fdnlens[3] = f_round(0.632450f*p->largestdelay);
   for(i = 0; i < FDNORDER; i++) {
-    p->fdngains[i] = -powf((float)p->alpha, p->fdnlens[i]);
+    p->fdngains[i] = -gverb_decay(p->alphalog2, p->fdnlens[i]);
   }
 
   p->taps[0] = 5+f_round(0.410f*p->largestdelay);
@@ -180,45 +275,54 @@ static __inline void gverb_set_roomsize(ty_gverb *p, const float a)
   p->taps[3] = 5+f_round(0.000f*p->largestdelay);
 
   for(i = 0; i < FDNORDER; i++) {
-    p->tapgains[i] = powf((float)p->alpha, p->taps[i]);
+    p->tapgains[i] = gverb_decay(p->alphalog2, p->taps[i]);
   }
 
 }
 
-static __inline void gverb_set_revtime(ty_gverb *p,float a)
+/*
+ * The revtime update is split in two, so that the FDN gains can be worked
+ * out away from the audio path (e.g. on the other core) and then applied
+ * between blocks in one go, rather than changing under gverb_do.
+ */
+static __inline float gverb_calc_revtime(const ty_gverb *p, float a, float *fdngains)
 {
-  float ga,gt;
-  double n;
+  float alphalog2;
   unsigned int i;
 
-  p->revtime = a;
-
-  ga = 60.0;
-  gt = p->revtime;
-  ga = powf(10.0f,-ga/20.0f);
-  n = p->rate*gt;
-  p->alpha = (double)powf(ga,1.0f/n);
+  alphalog2 = gverb_alphalog2(p->rate, a);
 
   for(i = 0; i < FDNORDER; i++) {
-    p->fdngains[i] = -powf((float)p->alpha, p->fdnlens[i]);
+    fdngains[i] = -gverb_decay(alphalog2, p->fdnlens[i]);
   }
+  return(alphalog2);
+}
 
+static __inline void gverb_apply_revtime(ty_gverb *p, float a, float alphalog2, const float *fdngains)
+{
+  p->revtime = a;
+  p->alphalog2 = alphalog2;
+  memcpy(p->fdngains, fdngains, FDNORDER * sizeof(float));
 }
 
-static __inline void gverb_set_damping(ty_gverb *p,float a)
+static __inline void gverb_set_revtime(ty_gverb *p,float a)
 {
-  unsigned int i;
+  float fdngains[FDNORDER];
+  float alphalog2;
+
+  alphalog2 = gverb_calc_revtime(p, a, fdngains);
+  gverb_apply_revtime(p, a, alphalog2, fdngains);
+}
 
+static __inline void gverb_set_damping(ty_gverb *p,float a)
+{
   p->fdndamping = a;
-  for(i = 0; i < FDNORDER; i++) {
-    damper_set(p->fdndamps[i],p->fdndamping);
-  }
 }
 
 static __inline void gverb_set_inputbandwidth(ty_gverb *p,float a)
 {
   p->inputbandwidth = a;
-  damper_set(p->inputdamper,1.0 - p->inputbandwidth);
+  damper_set(&p->inputdamper,1.0f - p->inputbandwidth);
 }
 
 static __inline void gverb_set_earlylevel(ty_gverb *p,float a)
@@ -4,14 +4,19 @@
 
 #include "ladspa-util.h"
 
+/* Delay buffers are power-of-two rings, so that the read and write
+ * indexes wrap with a mask rather than an integer modulo. */
+
 typedef struct {
-  int size;
+  int size;     /* ring length, a power of two */
+  int mask;
   int idx;
   float *buf;
 } ty_fixeddelay;
 
 typedef struct {
-  int size;
+  int size;     /* delay length in samples */
+  int mask;     /* ring length is the next power of two up from size */
   float coeff;
   int idx;
   float *buf;
@@ -22,23 +27,21 @@ typedef struct {
   float delay;
 } ty_damper;
 
-ty_diffuser *diffuser_make(int, float);
-void diffuser_free(ty_diffuser *);
+void diffuser_init(ty_diffuser *, int, float, float *);
 void diffuser_flush(ty_diffuser *);
 //float diffuser_do(ty_diffuser *, float);
 
-ty_damper *damper_make(float);
-void damper_free(ty_damper *);
+void damper_init(ty_damper *, float);
 void damper_flush(ty_damper *);
 //void damper_set(ty_damper *, float);
 //float damper_do(ty_damper *, float);
 
-ty_fixeddelay *fixeddelay_make(int);
-void fixeddelay_free(ty_fixeddelay *);
+void fixeddelay_init(ty_fixeddelay *, int, float *);
 void fixeddelay_flush(ty_fixeddelay *);
 //float fixeddelay_read(ty_fixeddelay *, int);
 //void fixeddelay_write(ty_fixeddelay *, float);
 
+int next_pow2(int);
 int isprime(int);
 int nearest_prime(int, float);
 
@@ -46,26 +49,67 @@ static __inline float diffuser_do(ty_diffuser *p, float x)
 {
   float y,w;
 
-  w = x - p->buf[p->idx]*p->coeff;
+  const float r = p->buf[(p->idx - p->size) & p->mask];
+
+  w = x - r*p->coeff;
   w = flush_to_zero(w);
-  y = p->buf[p->idx] + w*p->coeff;
+  y = r + w*p->coeff;
   p->buf[p->idx] = w;
-  p->idx = (p->idx + 1) % p->size;
+  p->idx = (p->idx + 1) & p->mask;
   return(y);
 }
 
 static __inline float fixeddelay_read(ty_fixeddelay *p, int n)
 {
-  int i;
-
-  i = (p->idx - n + p->size) % p->size;
-  return(p->buf[i]);
+  return(p->buf[(p->idx - n) & p->mask]);
 }
 
 static __inline void fixeddelay_write(ty_fixeddelay *p, float x)
 {
   p->buf[p->idx] = x;
-  p->idx = (p->idx + 1) % p->size;
+  p->idx = (p->idx + 1) & p->mask;
+}
+
+/* Block access to a ring: copy n samples starting at start, splitting
+ * the copy in two where it wraps past the end of the buffer. */
+static __inline void ring_read_block(const float *buf, int mask, int start, float *dst, int n)
+{
+  int first;
+
+  start &= mask;
+  first = mask + 1 - start;
+  if (first >= n) {
+    memcpy(dst, buf + start, n*sizeof(float));
+  } else {
+    memcpy(dst, buf + start, first*sizeof(float));
+    memcpy(dst + first, buf, (n - first)*sizeof(float));
+  }
+}
+
+static __inline void ring_write_block(float *buf, int mask, int start, const float *src, int n)
+{
+  int first;
+
+  start &= mask;
+  first = mask + 1 - start;
+  if (first >= n) {
+    memcpy(buf + start, src, n*sizeof(float));
+  } else {
+    memcpy(buf + start, src, first*sizeof(float));
+    memcpy(buf, src + first, (n - first)*sizeof(float));
+  }
+}
+
+/* n samples from delay samples behind the write index */
+static __inline void fixeddelay_read_block(const ty_fixeddelay *p, int delay, float *dst, int n)
+{
+  ring_read_block(p->buf, p->mask, p->idx - delay, dst, n);
+}
+
+static __inline void fixeddelay_write_block(ty_fixeddelay *p, const float *src, int n)
+{
+  ring_write_block(p->buf, p->mask, p->idx, src, n);
+  p->idx = (p->idx + n) & p->mask;
 }
 
 static __inline void damper_set(ty_damper *p, float damping)
@@ -77,7 +121,7 @@ static __inline float damper_do(ty_damper *p, float x)
 { 
   float y;
     
-  y = x*(1.0-p->damping) + p->delay*p->damping;
+  y = x*(1.0f-p->damping) + p->delay*p->damping;
   p->delay = y;
   return(y);
 }
@@ -74,6 +74,11 @@ static void calc_clocks(const i2s_config* config, pio_i2s_clocks* clocks) {
     clocks->sck_pio_hz = pio_div(sck_hz * (float)i2s_sck_program_pio_mult, &clocks->sck_d, &clocks->sck_f);
     float bck_hz       = clocks->fs_attained * (float)config->bit_depth * 2.0f;
     clocks->bck_pio_hz = pio_div(bck_hz * (float)i2s_out_master_program_pio_mult, &clocks->bck_d, &clocks->bck_f);
+
+    // LRCK is derived from BCK, so the frame length in system clocks is
+    // an exact integer once the divider is expressed in 1/256ths
+    clocks->frame_cycles_q8 = (((uint32_t)clocks->bck_d << 8) + clocks->bck_f) *
+                              (uint32_t)i2s_out_master_program_pio_mult * config->bit_depth * 2;
 }
 
 static bool validate_sck_bck_sync(pio_i2s_clocks* clocks) {
@@ -167,6 +172,7 @@ static void i2s_slave_program_init(PIO pio, const i2s_config* config, pio_i2s* i
 
     pio_i2s_clocks clocks;
     calc_clocks(config, &clocks);
+    i2s->clocks = clocks;
 
     if (config->sck_enable) {
         // SCK block
@@ -197,6 +203,7 @@ static void i2s_sync_program_init(PIO pio, const i2s_config* config, pio_i2s* i2
 
     pio_i2s_clocks clocks;
     calc_clocks(config, &clocks);
+    i2s->clocks = clocks;
 
     if (config->sck_enable) {
         // Check that SCK and BCK are in perfect whole ratio
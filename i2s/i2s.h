@@ -50,6 +50,9 @@ typedef struct pio_i2s_clocks {
     uint8_t  sck_f;
     uint16_t bck_d;
     uint8_t  bck_f;
+
+    // System clock cycles per stereo frame (Q8), exact from the BCK divider
+    uint32_t frame_cycles_q8;
 } pio_i2s_clocks;
 
 // NOTE: Use __attribute__ ((aligned(8))) on this struct or the DMA wrap won't work!
@@ -68,6 +71,7 @@ typedef struct pio_i2s {
     int32_t    input_buffer[STEREO_BUFFER_SIZE * 2];
     int32_t    output_buffer[STEREO_BUFFER_SIZE * 2];
     i2s_config config;
+    pio_i2s_clocks clocks;
 } pio_i2s;
 
 extern const i2s_config i2s_config_default;
@@ -30,14 +30,27 @@ SOFTWARE.
  */
 #ifndef PARROT_H
 #define PARROT_H
+#include <stdatomic.h>
 #include "psram_spi.h"
+#include "hardware/structs/m33.h"
 #include "freeverb/freeverb.h"
 #include "pverb/pverb.h"
 #include "gverb/include/gverb.h"
+#include "parrot_euclid.h"
 
+// Timer alarms programmed directly through timer_hw. Each one is claimed
+// with hardware_alarm_claim() when it is set up, so anything else that
+// asks for an alarm (the SDK's default alarm pool, add_alarm_in_us()
+// etc.) can't be handed one of these
 // External Clock input interrupt
 #define ALARM_NUM 0
 #define ALARM_IRQ timer_hardware_alarm_get_irq_num(timer_hw, ALARM_NUM)
+// core1 control tick interrupt
+#define CONTROL_ALARM_NUM 1
+#define CONTROL_ALARM_IRQ timer_hardware_alarm_get_irq_num(timer_hw, CONTROL_ALARM_NUM)
+// Algorithm / Divisor switch debounce interrupt
+#define SWITCH_ALARM_NUM 2
+#define SWITCH_ALARM_IRQ timer_hardware_alarm_get_irq_num(timer_hw, SWITCH_ALARM_NUM)
 
 /**
  * @brief Various fixed point conversion, multiplication and division macros
@@ -65,6 +78,56 @@ typedef signed short s1x14 ;
 #define float_to_int32(x) (((int) ((x * 2147483647) + 2147483648.5f)) - 2147483648)
 #define int_to_float(x) ((((float) (x + 8388608)) - 8388608.5f) / 8388607.f)
 #define int32_to_float(x) ((((float) (x + 2147483648)) - 2147483648.5f) / 2147483648.f)
+/**
+ * @brief Cortex-M33 DWT cycle counter
+ * 
+ * Each core has its own counter, which has to be enabled on that
+ * core with cycle_counter_init() before cycle_count() is used
+ */
+__force_inline static void cycle_counter_init(void){
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_cyccnt = 0;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+}
+__force_inline static uint32_t cycle_count(void){
+    return m33_hw->dwt_cyccnt;
+}
+
+/**
+ * @brief audio path profiler regions (see parrot_profile.c)
+ * 
+ * Regions nest - PROF_BLOCK covers everything, and PROF_PSRAM is
+ * counted wherever the PSRAM is accessed from, including inside
+ * the other regions
+ */
+typedef enum {
+    PROF_BLOCK,                     // the whole of process_audio
+    PROF_SAMPLE_LOOP,               // per-sample loop, including the per-sample algorithms
+    PROF_FREEVERB,                  // fv_process
+    PROF_PVERB,                     // pv_process
+    PROF_GVERB,                     // gverb_do_block
+    PROF_EUCLIDEAN,                 // Euclidean_Delay
+    PROF_PSRAM,                     // PSRAM reads & writes
+    PROF_REGIONS
+} profile_region;
+
+#ifdef PARROT_PROFILE
+extern uint32_t ProfileAcc[PROF_REGIONS];
+// time a statement, adding its cycles to the region's total for this block
+#define PROFILE(region, stmt) do { uint32_t _pt = cycle_count(); stmt; ProfileAcc[region] += cycle_count() - _pt; } while (0)
+// or time everything between a BEGIN and an END
+#define PROFILE_BEGIN(t) uint32_t t = cycle_count()
+#define PROFILE_END(region, t) (ProfileAcc[region] += cycle_count() - (t))
+#else
+#define PROFILE(region, stmt) do { stmt; } while (0)
+#define PROFILE_BEGIN(t)
+#define PROFILE_END(region, t)
+#define profile_init(budget)
+#define profile_block_start()
+#define profile_block(algorithm)
+#define profile_poll()
+#endif
+
 /**
  * @brief union of a float and a 32-Bit integer
  * 
@@ -78,6 +141,162 @@ union uSample {
     int32_t iSample;
 };
 
+#define TAP_MAXBLOCK 64                     // Most frames a multi-tap delay reads in one burst
+#define POT_ADC_CHANNELS 3                  // Feedback, Clock & Wet/Dry pots, sampled round-robin on ADC0..2
+#define POT_OVERSAMPLE 64                   // ADC samples per pot averaged into each decimated value
+#define MULTITAP_MAX_TAPS 16                // Most taps in the generic multi-tap delay
+#define MULTITAP_SPAN_FRAMES (4 * TAP_MAXBLOCK) // Longest merged multi-tap PSRAM read, in frames
+#define PROFILE_ALGORITHMS 8                // One set of profiler stats per Algorithm switch position
+#define PROFILE_HIST_BINS 16                // Block time histogram bins, each 1/8th of the block budget
+
+/**
+ * @brief Multi-tap delay element
+ * 
+ * One tap of the generic multi-tap delay. Feedback is only taken from
+ * taps that are at least TAP_MAXBLOCK frames long, as shorter taps
+ * read samples from the block that is being written.
+ */
+typedef struct tap_element{
+    uint32_t delay;                         // offset behind the write pointer, in frames
+    float  feedback;                        // amount fed back into the same channel
+    float  crossfeed;                       // amount fed back into the opposite channel
+    float  gain;                            // level in the wet output
+    float  pan;                             // position, -1.0 (left) to +1.0 (right), equal power
+}tap_element;
+
+/**
+ * @brief one contiguous PSRAM read, serving one or more multi-tap taps
+ */
+typedef struct {
+    uint32_t offset;                        // offset of the start of the read (its longest tap)
+    uint32_t frames;                        // frames read beyond the block length
+    int first;                              // first tap (in sorted order) served by this read
+    int count;                              // number of taps served
+    bool late;                              // taps shorter than TAP_MAXBLOCK, read after the block is written
+} multitap_span;
+
+/**
+ * @brief generic multi-tap delay
+ * 
+ * The taps are held sorted by delay, with taps whose reads overlap
+ * or touch merged into a single span, so each block costs as few
+ * PSRAM burst reads as possible
+ */
+typedef struct {
+    int numtaps;
+    tap_element taps[MULTITAP_MAX_TAPS];
+    float gain_l[MULTITAP_MAX_TAPS];        // left and right output gains of each tap, gain and pan combined
+    float gain_r[MULTITAP_MAX_TAPS];
+    int numspans;
+    multitap_span span[MULTITAP_MAX_TAPS];
+    uint32_t transactions;                  // PSRAM SPI transactions in the last call
+} multitap;
+
+#define EUCLID_MAX_TAPS (2 * EUCLID_MAX_STEPS) // Left and right patterns, each with up to EUCLID_MAX_STEPS taps
+#define EUCLID_PAN_STEP 0.25f               // How far each successive tap moves out from the centre
+
+/**
+ * @brief one stereo read of the Euclidean delay
+ * 
+ * Left and right pattern taps that land on the same offset share
+ * a single read, so each read carries the gain from both the left
+ * and right channels of the delay buffer to both outputs
+ */
+typedef struct {
+    uint32_t offset;                        // offset behind the write pointer, in frames
+    float ll, lr;                           // gain from the left channel to the left & right outputs
+    float rl, rr;                           // gain from the right channel to the left & right outputs
+} euclid_tap;
+
+/**
+ * @brief Euclidean tap plan
+ * 
+ * The reads, gains and pans for the current left and right Euclidean
+ * patterns. This only changes when the delays, divisor, fill or
+ * rotation change, so it is worked out then rather than on every sample
+ */
+typedef struct {
+    uint32_t delay_L;                       // glbDelay_L the plan was made for
+    uint32_t delay_R;                       // glbDelay_R the plan was made for
+    int divisor;                            // glbDivisor the plan was made for
+    int fill;                               // glbEuclideanFill the plan was made for
+    int rotation;                           // euclid_rotation the plan was made for
+    int numtaps;                            // 'hits' in the left plus right patterns
+    int numreads;                           // distinct offsets, one stereo burst read each
+    euclid_tap read[EUCLID_MAX_TAPS];
+} euclid_plan;
+
+/**
+ * @brief Reverb coefficient set
+ * 
+ * Worked out on core1 whenever the Feedback or Wet/Dry pots move, then
+ * handed to core0 through a double buffer. Core0 applies it between
+ * audio blocks, so the reverbs never see a half-updated set.
+ */
+#define REVERB_ROOM     0x01        // roomsize / revtime have changed
+#define REVERB_WETDRY   0x02        // wet / dry levels have changed
+typedef struct {
+    uint32_t changed;               // REVERB_ROOM | REVERB_WETDRY
+    float roomsize;                 // freeverb & pverb room size (0 .. 1)
+    float revtime;                  // gverb reverb time
+    float gverb_alphalog2;
+    float gverb_fdngains[FDNORDER];
+    float wet;
+    float dry;
+} reverb_coeffs;
+
+/**
+ * @brief Control parameter snapshot
+ * 
+ * Everything core0 needs from the user interface. core1 publishes a
+ * new version through a seqlock whenever anything changes, and core0
+ * takes one copy at the start of each audio block, so a block always
+ * sees a consistent set and neither core ever waits for the other.
+ */
+typedef struct {
+    uint32_t targetDelay_L;         // delay (in samples) the left channel ramps towards
+    uint32_t targetDelay_R;         // delay (in samples) the right channel ramps towards
+    uint32_t jump_L;                // bumped when the left delay should jump straight to its target
+    uint32_t jump_R;                // bumped when the right delay should jump straight to its target
+    float wet;
+    float dry;
+    float feedback;
+    int algorithm;
+    int divisor;                    // also picks the Euclidean pattern length (EuclideanSteps)
+    int euclid_fill;                // Euclidean pattern hits, never more than its steps
+    int euclid_rotation;            // steps the right pattern is rotated from the left (euclid_rotation())
+} parrot_params;
+
+/**
+ * @brief User interface event
+ * 
+ * Queued as the inputs are picked up and applied later by the core1
+ * main loop, so nothing that catches an input (an IRQ, or the encoder
+ * poll) ever has to do the work itself
+ */
+#define UI_EVENT_QUEUE_LEN 32       // must be a power of 2
+#define UI_EVENT_ENCODER 0x01       // value = detents turned since the last poll, + clockwise / - anti-clockwise
+typedef struct {
+    uint32_t time;                  // time_us_32() when the event happened
+    uint8_t type;                   // UI_EVENT_xxx
+    int8_t value;
+} ui_event;
+
+/**
+ * @brief Block parameter ramp
+ * 
+ * Audio-rate parameters step from their previous value to the
+ * latest value linearly across each audio block, rather than
+ * jumping mid-block when core1 updates them (zipper noise).
+ * Each frame just adds the increment, so there is no branching.
+ */
+typedef struct {
+    float value;                    // value for the current frame
+    float step;                     // added once per frame
+    float start;                    // value for the first frame of the block
+    float target;                   // value reached at the end of the block
+} param_ramp;
+
 // AllPass filter structure
 typedef struct {
     float a1; // Coefficient for the filter
@@ -86,15 +305,28 @@ typedef struct {
 
 // Global Variables - Constants
 static const double ClockScale = 0.04884;       // (= (240-40)/4095) scales the internal clock BPM from 40 to 240BPM
-static const uint Clock_MA_Len = 3;             // Length of the Clock Pot Moving Average buffer
-static const uint WetDry_MA_Len = 5;            // Length of the Wet/Dry pot MA buffer
-static const uint ExtClock_MA_Len = 10;         // Length of the ExtClock Moving Average buffer (to filter out timing irregularities)
-static const uint32_t ClockHysteresis = 0xFF;   // +/- Amount the clock has to vary before we note a new clock period (to overcome jitter)
+static const uint64_t EXTCLOCK_TIMEOUT = 12000000; // uS without an external clock edge before the tempo tracker starts again
+static const double EXTCLOCK_RELOCK = 0.02;     // Fractional tempo change at which the tracker re-locks rather than follows
+static const double EXTCLOCK_OUTLIER = 0.2;     // Fractional deviation from the median at which an edge is ignored
+static const double EXTCLOCK_PLL_ALPHA = 0.2;   // Tempo tracker phase gain
+static const double EXTCLOCK_PLL_BETA = 0.02;   // Tempo tracker period gain
+static const uint32_t SyncDelayHysteresis = 256;    // the sync'd delay has to move by 1/256th of itself before it is changed (to overcome jitter)...
+static const uint32_t SyncDelayHysteresisMin = 2;   // ...or by this many samples, whichever is more
 static const float Feedback_scale = 0.0002442;  // (= 1/4095 )fixed scale factor to scale the Feedback ADC value to give a Percentage feedback from 0 to 1
 static const float WetDry_Scale = 0.02442;      // (= 100/4095)fixed scale factor to scale the Divisor ADC value to give a value from 0 to 100
-static const float SampleLength = 1000000.0f/96000.0f; // Length of 1 stereo sample in uS (10.4166ms).  
-static const uint Feedback_MA_Len = 3;          // Length of the Feedback Moving Average ring buffer
-static const uint Tick_MA_Len = 1;              // Length of the Rotary Encoder tick speed Moving Average ring buffer
+static const uint32_t POT_ADC_RATE = 30000;     // Aggregate ADC sample rate across the three pots (10kHz per pot)
+static const uint32_t CONTROL_TICK_US = 1000;   // uS between core1 control ticks (1kHz)
+static const uint32_t CONTROL_POT_DIV = 1;      // Control ticks between decimated pot values being acted upon (1kHz)
+static const uint32_t CONTROL_SWITCH_DIV = 5;   // Control ticks between the Sync/Free switch being polled (200Hz)
+static const uint32_t CONTROL_TELEMETRY_DIV = 100; // Control ticks between checks for a USB console report (10Hz)
+static const uint32_t IRQ_REPORT_INTERVAL = 5000000; // uS between GPIO IRQ timing reports (PARROT_BENCHMARK only)
+static const int ENCODER_COUNTS_PER_DETENT = 4; // Quadrature edges per Rotary Encoder detent
+static const int ENCODER_MAX_STEP_RATE = 10000; // Quadrature edges/s the PIO decoder samples for (sets its clock divider)
+static const int POT_HYSTERESIS = 8;            // ADC counts a pot has to move before the change is acted upon
+static const uint Tick_MA_Len = 3;              // Length of the Rotary Encoder tick speed Moving Average ring buffer
+static const uint32_t ENCODER_IDLE_TIME = 300000;   // uS between detents after which the encoder counts as starting from rest
+static const uint32_t ENCODER_ACCEL_INTERVAL = 150000; // uS between detents below which the delay increment is accelerated
+static const uint32_t ENCODER_ACCEL_MAX = 100;  // Largest Rotary Encoder acceleration factor
 //static const uint32_t BUF_LEN = 0x7FFFFC;       // Actual Audio Buffer length in Mb = 8Mb. 
 // GPIO Pin definitions
 static const uint32_t BUF_LEN = 0x7FFFF;        // PSRAM buffer length in L-R Sample pairs 
@@ -105,6 +337,7 @@ static const uint DIVISOR_0 = 3;                // 8-Way BCD switch-A
 static const uint DIVISOR_1 = 4;                // 8-Way BCD switch-B                   Physical Pin 6
 static const uint DIVISOR_2 = 5;                // 8-Way BCD switch-C                   Physical Pin 7
 static const uint DIVISOR_3 = 6;                // Mul/Div switch provides 4th Bit      Physical Pin 9
+static const uint32_t SWITCH_GPIO_MASK = 0x7F;  // ALGORITHM_0..2 + DIVISOR_0..3, debounced by SWITCH_ALARM_NUM
 static const uint I2S_DOUT = 7;                 // I2S Data Out                         Physical Pin 10
 static const uint I2S_DIN = 8;                  // I2S Data In                          Physical Pin 11
 static const uint I2S_BCK = 9;                  // I2S Bit Clock                        Physical Pin 12
@@ -113,7 +346,7 @@ static const uint I2S_SCK = 11;                 // I2S System Clock
 static const uint XSMT_PIN = 12;                // PCM5102 Soft-mute                    Physical Pin 16 
 static const uint ENCODER_SW = 13;              // Rotary Encoder switch                Physical pin 17
 static const uint ENCODERA_IN = 14;             // Rotary encoder A-leg                 physical pin 19 
-static const uint ENCODERB_IN = 15;             // Rotary encoder B-leg                 physical pin 20
+static const uint ENCODERB_IN = 15;             // Rotary encoder B-leg                 physical pin 20 (must be ENCODERA_IN + 1 for the PIO decoder)
 static const uint SPI_CS=16;                    // Set in CMakeLists as PSRAM_PIN_CS    Physical Pin 21 
 static const uint SPI_SCK=17;                   // Set in CMakeLists as PSRAM_PIN_SCK   Physical Pin 22
 static const uint SPI_MOSI=18;                  // Set in CMakeLists as PSRAM_PIN_MOSI  Physical Pin 24
@@ -132,6 +365,18 @@ static const uint ADC_feedback = 0;
 static const uint ADC_Clock = 1;
 static const uint ADC_WetDry = 2; 
 
+/**
+ * @brief PSRAM burst limits
+ * 
+ * rp2040-psram sends the write and read bit counts of each SPI transaction
+ * as single bytes, so one write can carry at most 27 data bytes after the
+ * 4-byte command/address, and one read at most 31 bytes. Bursts are also
+ * kept within a 1kB APS6404L page.
+ */
+#define PSRAM_PAGE_SIZE         1024
+#define PSRAM_WRITE_BURST_MAX   24      // 6 x 32-Bit words
+#define PSRAM_READ_BURST_MAX    28      // 7 x 32-Bit words
+
 // Global Variables defined in parrot_main.c
 extern float AllPassState;
 extern double ClockBPM;            // BPM Value for interal clock
@@ -145,17 +390,24 @@ extern float glbRatio;
 extern int glbDivisor;
 extern int glbEuclideanFill; 
 extern float divisors[];
+extern const uint8_t DivisorNum[];
+extern const uint8_t DivisorDen[];
+extern uint32_t FrameCyclesQ8;
 extern int EuclideanSteps[];
-extern int EuclideanHits[];
 extern int glbAlgorithm;
 extern uint64_t DeBounceTime;
 extern ty_gverb * parrot_gverb;
 extern fv_Context parrot_freeverb;
 extern pv_Context parrot_pverb;
+extern reverb_coeffs ReverbCoeffs[2];
+extern _Atomic int ReverbCoeffsPending;
+extern volatile parrot_params SharedParams;
+extern _Atomic uint32_t SharedParamsSeq;
+extern parrot_params BlockParams;
 
 //  Global variables defined in parrot_core1.c
 extern _Atomic int32_t ExtClockPeriod;     // External Clock Period (rising edge to rising edge)
-extern _Atomic int32_t ExtClockTick;       // Records the last tick for the External Clock
+extern _Atomic uint32_t ExtClockCycles;    // External Clock Period in system clock cycles
 extern uint32_t glbDelay_L;
 extern uint32_t glbDelay_R;
 extern uint32_t targetDelay_L;
@@ -165,8 +417,9 @@ extern uint32_t glbIncrement;
 extern int32_t DelayDiff;
 extern float glbWet;
 extern float glbDry;
-extern int spinlock_num_glbDelay;
-extern spin_lock_t *spinlock_glbDelay;
+extern param_ramp WetRamp;
+extern param_ramp DryRamp;
+extern param_ramp FeedbackRamp;
 extern int ClockPhase;                      // Toggles between 0 & 1
 extern int LEDPhase;                        // On-board LED phase
 extern float FeedbackPercent;
@@ -175,14 +428,18 @@ extern float FeedbackPercent;
 void core1_entry(void);
 
 // function prototypes - parrot_func.c
-unsigned int bjorklund(int,int);
-unsigned int euclid_bit_pattern(int,int);
-int bitRead(unsigned int, unsigned int);
 size_t get_free_ram(void);
+void gverb_benchmark(ty_gverb *, int);
 float WaveFolder(float, float);
 float WaveWrapper(float, float);
 extern psram_spi_inst_t psram_spi;
-float Euclidean_Delay(float);
+uint32_t psram_burst_read(uint32_t, void *, uint32_t);
+uint32_t psram_burst_write(uint32_t, const void *, uint32_t);
+uint32_t psram_ring_read(uint32_t, uint32_t, uint32_t, float *, uint32_t);
+uint32_t psram_ring_write(uint32_t, uint32_t, uint32_t, const float *, uint32_t);
+uint32_t psram_frames_read(uint32_t, union uSample *, uint32_t);
+uint32_t psram_frames_write(uint32_t, const union uSample *, uint32_t);
+void Euclidean_Delay(const float *, float *, uint32_t, uint32_t);
 float single_delay(union uSample, bool);
 float single_tap(union uSample, float, bool);
 float Ping_Pong(union uSample, float, bool);
@@ -190,19 +447,44 @@ int32_t single_tap_shift(int32_t, uint32_t, uint8_t);
 /**
  * @brief Wet/Dry mix
  * 
- * Uses the global Wet & Dry levels to retun a mix of the 
+ * Uses the ramped Wet & Dry levels to retun a mix of the 
  * passed wet and dry samples
  * 
  * @param DrySample
  * @param WetSample
  */
 __force_inline static float WetDry(float DrySample, float WetSample){
-    return (DrySample * glbDry) + (WetSample * glbWet); 
+    return (DrySample * DryRamp.value) + (WetSample * WetRamp.value); 
+}
+/**
+ * @brief advance the Wet, Dry & Feedback ramps by one frame
+ */
+__force_inline static void step_ramps(void){
+    WetRamp.value += WetRamp.step;
+    DryRamp.value += DryRamp.step;
+    FeedbackRamp.value += FeedbackRamp.step;
 }
 
 float rational_tanh(float);
 float soft_clip(float);
 
+// function prototypes - parrot_multitap.c
+#ifdef PARROT_MULTITAP
+void multitap_init(multitap *, const tap_element *, int);
+void multitap_process(multitap *, const float *, float *, uint32_t, uint32_t);
+void multitap_benchmark(void);
+#endif
+
+// function prototypes - parrot_profile.c
+#ifdef PARROT_PROFILE
+void profile_init(uint32_t);
+void profile_block_start(void);
+void profile_block(int);
+void profile_reset(void);
+void profile_dump(void);
+void profile_poll(void);
+#endif
+
 #define WORD16_PATTERN "%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c"
 #define WORD16_TO_BINARY(byte)  \
   ((byte) & 0x0008000 ? '1' : '0'), \
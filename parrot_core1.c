@@ -34,164 +34,252 @@ SOFTWARE.
  * and acted upon by the time-critical functions in parrot_main
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <arm_math.h>
 #include "parrot.h"
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
 #include "hardware/irq.h"
+#include "hardware/timer.h"
 #include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
 #include "hardware/sync.h"
+#include "hardware/pio.h"
+#include "quadrature_encoder.pio.h"
+#include "clock_timestamp.pio.h"
 
 bool temp = false;
 
 double ClockBPM;                  // BPM Value for interal clock
 double ClockFreq;                 // Internal Clock Frequency
 double ClockPeriod;               // Internal Clock Period
+volatile uint32_t ClockPeriodQ12 = 0; // Internal Clock half-period in 1/4096 uS, as used by the alarm IRQ
+uint64_t ClockDeadlineQ12;        // Absolute time of the next CLOCK_OUT edge in 1/4096 uS (alarm IRQ only)
+uint32_t ClockEdges = 0;          // CLOCK_OUT edges generated
+volatile uint32_t ClockLateMax = 0; // Longest an edge has been late against its deadline (uS)
 int ClockPhase;                   // Toggles between 0 & 1 
 int LEDPhase;                     // on-board LED - Toggles between 0 & 1 
-int LatestDivisor;                  // Temp value of the mul/div switch if it changes
-uint64_t DivisorChangedTime;        // Time at which the switch last changed value (for debouncing)
-int LatestAlgorithm = 0;            // latest value for the Algorithm Switch that may or may not be the same as glbAlgorithm
-uint64_t AlgorithmChangedTime;      // Time at which the Algorithm Switch changed
+uint64_t ReverbReportTime;          // Time at which the pverb stats were last reported
 
-_Atomic int32_t ExtClockPeriod;   // External Clock Period (rising edge to rising edge)
-_Atomic int32_t ExtClockTick;     // Records the last tick for the External Clock
+_Atomic int32_t ExtClockPeriod;   // External Clock Period (rising edge to rising edge) in uS
+_Atomic uint32_t ExtClockCycles;  // External Clock Period in system clock cycles
 uint SyncFree;                    // Delay time is just controlled by Rotary Encoder, or sync'd to external/internal clock
-uint16_t Feedback_MA[16];         // 16-byte moving average buffer for feedback pot. NOTE: statically defined length. We'll not use all 16 elements.
-uint Feedback_MA_Ptr;             // Pointer to Moving Average buffer
-uint16_t Feedback_Average;        // Moving average result
-long Feedback_MA_Sum;             // Running total of the values in the buffer
-uint16_t  Clock_MA[16];           // Clock input Moving Average buffer
-uint Clock_MA_Ptr;
-uint16_t Clock_Average;
-long Clock_MA_Sum;
-uint16_t  WetDry_MA[16];          // We/Dry input Moving Average buffer
-uint WetDry_MA_Ptr;
-uint16_t WetDry_Average;
-long WetDry_MA_Sum;
-uint32_t  ExtClock_MA[16];        // External Clock input Moving Average buffer
-uint ExtClock_MA_Ptr;
-uint32_t ExtClock_Average;
-long ExtClock_MA_Sum;
-uint8_t lrmem = 3;
-int lrsum = 0;
-// Rotary encoder state transition table
-int8_t TRANS[] = {0, -1, 1, 14, 1, 0, 14, -1, -1, 14, 0, 1, 14, 1, -1, 0};
+// Pot samples are written here by DMA straight from the ADC FIFO. The length is a
+// whole number of round-robin passes, so each slot always holds the same pot
+static volatile uint16_t PotSamples[POT_ADC_CHANNELS * POT_OVERSAMPLE];
+static volatile uint16_t *PotSamplesAddr = PotSamples;  // control block: re-loaded into the data channel's write address
+uint PotDmaData;                  // DMA channel draining the ADC FIFO
+uint PotDmaCtrl;                  // DMA channel that restarts PotDmaData at the top of PotSamples
+uint64_t PotPublishTime;          // Time at which the pot ring is first full
+uint16_t Feedback_Average;        // Decimated Feedback pot value
+int Feedback_Applied = -1000;     // Feedback average last acted upon (forces an update on the first pass)
+uint16_t Clock_Average;           // Decimated Clock pot value
+uint16_t WetDry_Average;          // Decimated Wet/Dry pot value
+int WetDry_Applied = -1000;       // Wet/Dry average last acted upon
+reverb_coeffs NextReverbCoeffs;   // Reverb coefficients waiting to be handed over to core0
+int ReverbCoeffsWriteIdx = 0;     // Half of the ReverbCoeffs double buffer that core1 writes next
+uint32_t DelayJump_L = 0;         // Bumped to make core0 jump the left delay straight to its target
+uint32_t DelayJump_R = 0;         // Bumped to make core0 jump the right delay straight to its target
+static ui_event UIEvents[UI_EVENT_QUEUE_LEN]; // Events from the GPIO IRQ waiting for the main loop
+static _Atomic uint32_t UIEventHead = 0;  // Next slot the IRQ writes
+static _Atomic uint32_t UIEventTail = 0;  // Next slot the main loop reads
+uint32_t UIEventsDropped = 0;     // Events lost because the queue was full
+uint32_t GpioIrqMaxCycles = 0;    // Longest time spent in the GPIO IRQ callback
+uint64_t IrqReportTime;           // Time at which the GPIO IRQ timing was last reported
+volatile uint32_t ControlTicks = 0; // Control ticks raised by the alarm IRQ
+volatile uint32_t ControlTickDue; // Timer value (uS) the latest control tick was due at
+uint32_t ControlDeadline;         // Timer value (uS) the next control tick is due at (alarm IRQ only)
+uint32_t ControlTickDone = 0;     // Latest control tick the main loop has run
+uint32_t ControlJitterMax = 0;    // Longest from a control tick being due to its tasks starting (uS)
+uint32_t ControlBusyMax = 0;      // Longest time spent running one control tick's tasks (cycles)
+uint32_t ControlOverruns = 0;     // Control ticks skipped because the previous tick ran too long
+uint ClockSM;                     // pio2 state machine timestamping the external clock edges
+uint32_t ClockLastStamp;          // Timestamp of the last edge, in units of 3 system clock cycles
+uint64_t ClockLastStampTime;      // time_us_64() when the last edge timestamp was picked up
+bool ClockStampValid = false;     // ClockLastStamp can be used to measure the next interval
+uint32_t ClockIntervals[3];       // Last 3 edge intervals (cycles) for the median filter
+uint ClockIntervalPtr;
+uint ClockIntervalCount;
+double TempoPeriod = 0;           // Tracked clock period in cycles (0 = not locked)
+double TempoOffset = 0;           // Tracked edge time less the actual last edge time, in cycles
+double ClockCyclesPerUs;          // System clock cycles per uS
+bool ClockEdgePending = false;    // A new edge has updated ExtClockCycles since the sync'd delay was last checked
+uint EncoderSM;                   // pio2 state machine decoding the Rotary Encoder
+int32_t EncoderCount = 0;         // Latest quadrature count from the state machine
+int32_t EncoderDetentCount = 0;   // Count at the last detent acted upon
+uint32_t LastDetentTime;          // Time of the last poll that picked up Rotary Encoder detents
+uint32_t Tick_MA[16];             // Rotary Encoder time between detents Moving Average buffer
+uint Tick_MA_Ptr;
+uint32_t Tick_MA_Sum;
 
 
 /***********************
  * Function Definitions
  ***********************/
 /**
- * @brief Rotary Encoder finite state machine
- * 
- * This comes from a technical paper by Marko Pinteric
- * https://www.pinteric.com/rotary.html, with additions
- * by Ralph S. Bacon
- * https://github.com/RalphBacon/226-Better-Rotary-Encoder---no-switch-bounce
- */
-int8_t checkRotaryEncoder()
-{
-    // Read BOTH pin states to deterimine validity of rotation (ie not just switch bounce)
-    int8_t l = gpio_get(ENCODERA_IN);
-    int8_t r = gpio_get(ENCODERB_IN);
-    // Move previous value 2 bits to the left and add in our new values
-    lrmem = ((lrmem & 0x03) << 2) + 2 * l + r;
-    // Convert the bit pattern to a movement indicator (14 = impossible, ie switch bounce)
-    lrsum += TRANS[lrmem];
-    /* encoder not in the neutral (detent) state */
-    if (lrsum % 4 != 0){
-        return 0;
-    }
-    /* encoder in the neutral state - clockwise rotation*/
-    if (lrsum == 4){
-        lrsum = 0;
-        return 1;
-    }
-    /* encoder in the neutral state - anti-clockwise rotation*/
-    if (lrsum == -4){
-        lrsum = 0;
-        return -1;
-    }
-    // An impossible rotation has been detected - ignore the movement
-    lrsum = 0;
-    return 0;
+ * @brief queue a user interface event for the main loop
+ * 
+ * There is a single producer and a single consumer, so head and
+ * tail each have a single writer and no lock is needed, even if a
+ * producer is later moved into an IRQ. If the queue is full the event is
+ * dropped and counted.
+ * 
+ * @param type UI_EVENT_xxx
+ * @param value event specific value
+ */
+static void pushUIEvent(uint8_t type, int8_t value){
+  uint32_t head = atomic_load_explicit(&UIEventHead, memory_order_relaxed);
+  if ((head - atomic_load_explicit(&UIEventTail, memory_order_acquire)) >= UI_EVENT_QUEUE_LEN){
+    UIEventsDropped++;
+    return;
+  }
+  ui_event *e = &UIEvents[head & (UI_EVENT_QUEUE_LEN - 1)];
+  e->time = time_us_32();
+  e->type = type;
+  e->value = value;
+  atomic_store_explicit(&UIEventHead, head + 1, memory_order_release);
+}
+/**
+ * @brief take the oldest event off the user interface queue
+ * 
+ * @param e receives the event
+ * @return true if there was an event
+ */
+static bool popUIEvent(ui_event *e){
+  uint32_t tail = atomic_load_explicit(&UIEventTail, memory_order_relaxed);
+  if (tail == atomic_load_explicit(&UIEventHead, memory_order_acquire)) return false;
+  *e = UIEvents[tail & (UI_EVENT_QUEUE_LEN - 1)];
+  atomic_store_explicit(&UIEventTail, tail + 1, memory_order_release);
+  return true;
+}
+/**
+ * @brief start the PIO quadrature decoder for the Rotary Encoder
+ * 
+ * The pico-examples quadrature program runs on pio2 and keeps a
+ * signed count of every quadrature edge without any IRQs. Contact
+ * bounce just steps the count back and forth across one edge, so it
+ * cancels out, and the state machine clock is slowed to sample at
+ * ENCODER_MAX_STEP_RATE which also ignores very short glitches.
+ */
+static void initEncoder(){
+    // the program uses computed jumps, so has to be loaded at offset 0
+    pio_add_program_at_offset(pio2, &quadrature_encoder_program, 0);
+    EncoderSM = pio_claim_unused_sm(pio2, true);
+    quadrature_encoder_program_init(pio2, EncoderSM, ENCODERA_IN, ENCODER_MAX_STEP_RATE);
+    EncoderCount = 0;
+    EncoderDetentCount = 0;
+    // so that the first detent starts off slow
+    LastDetentTime = time_us_32() - ENCODER_IDLE_TIME;
+}
+/**
+ * @brief read the Rotary Encoder count and queue any detents
+ * 
+ * Called from the core1 main loop. The state machine counts every
+ * edge, so no steps are lost however long it is between polls. All
+ * of the detents picked up by one poll go in a single event, so the
+ * acceleration sees the real time they took
+ */
+static void pollEncoder(){
+  EncoderCount = quadrature_encoder_poll_count(pio2, EncoderSM, EncoderCount);
+  // The PIO reads A (ENCODERA_IN, the pin base) into bit 0 and B into
+  // bit 1, the other way round from the old 2*A + B decoder, so its
+  // count goes down when the knob is turned clockwise. Detents are
+  // taken from the count going down, so clockwise is positive and
+  // lengthens the delay (or adds Euclidean hits), as it always has
+  int32_t detents = (EncoderDetentCount - EncoderCount) / ENCODER_COUNTS_PER_DETENT;
+  if (detents == 0) return;
+  // anything beyond what fits in one event is left for the next poll
+  if (detents > INT8_MAX) detents = INT8_MAX;
+  if (detents < -INT8_MAX) detents = -INT8_MAX;
+  EncoderDetentCount -= detents * ENCODER_COUNTS_PER_DETENT;
+  pushUIEvent(UI_EVENT_ENCODER, (int8_t)detents);
+}
+/**
+ * @brief work out how fast the Rotary Encoder is being turned
+ * 
+ * The time between detents is run through a moving average buffer,
+ * and once that is shorter than ENCODER_ACCEL_INTERVAL the delay
+ * increment is multiplied up by the square of the speed, so slow
+ * turns keep the full resolution but a fast flick can cover the
+ * whole buffer in a few detents
+ * 
+ * @param time time the detents were picked up (time_us_32)
+ * @param detents number of detents picked up at that time
+ * @return factor to multiply the delay increment by (1 = no acceleration)
+ */
+static uint32_t encoderAcceleration(uint32_t time, uint32_t detents){
+  // time per detent since the last poll that saw any
+  uint32_t interval = (time - LastDetentTime) / detents;
+  LastDetentTime = time;
+  if (interval >= ENCODER_IDLE_TIME){
+    // first detent after a pause, so start again from slow
+    for (Tick_MA_Ptr = 0; Tick_MA_Ptr < Tick_MA_Len; Tick_MA_Ptr++) Tick_MA[Tick_MA_Ptr] = ENCODER_IDLE_TIME;
+    Tick_MA_Ptr = 0;
+    Tick_MA_Sum = ENCODER_IDLE_TIME * Tick_MA_Len;
+    return 1;
+  }
+  Tick_MA_Sum = Tick_MA_Sum - Tick_MA[Tick_MA_Ptr] + interval;
+  Tick_MA[Tick_MA_Ptr++] = interval;
+  if (Tick_MA_Ptr >= Tick_MA_Len) Tick_MA_Ptr = 0;
+  uint32_t Tick_Average = Tick_MA_Sum / Tick_MA_Len;
+  if (Tick_Average >= ENCODER_ACCEL_INTERVAL) return 1;
+  // a very fast turn can still average under 1uS per detent
+  float speed = (float)ENCODER_ACCEL_INTERVAL / (float)((Tick_Average > 0) ? Tick_Average : 1);
+  float factor = speed * speed;
+  return (factor >= (float)ENCODER_ACCEL_MAX) ? ENCODER_ACCEL_MAX : (uint32_t)factor;
 }
-
 /**
- * @brief Rotary Encoder IRQ callback
+ * @brief delay increment per Rotary Encoder detent, before acceleration
+ * 
+ * The larger the target delay, the larger the increment and
+ * therefore the lower the resolution
+ * 
+ * @param delay current target delay (samples)
+ */
+static uint32_t encoderIncrement(uint32_t delay){
+  // TODO: probably play with these thresholds and
+  // increments to arrive at something meaningful
+  switch(delay){
+    case 0 ... 1000:
+      return 10;
+    case 1001 ... 10000:
+      return 100;
+    case 10001 ... 100000:
+      return 1000;
+    case 100001 ... 1000000:
+      return 10000;
+    case 1000001 ... 10000000:
+      return 100000;
+    default:
+      return 48000;
+  }
+}
+/**
+ * @brief act on one Rotary Encoder detent
  * 
  * In Free-running mode (ie sync'd to the internal or external clock)
  * this increases or decreases the targetDelay, which is the delay that
  * the glbDelay value is aiming for, but ony moving towards by one sample
- * at a time.
+ * at a time. The increment grows with the target delay and with how
+ * fast the encoder is being turned.
  * 
- * The larger the target delay, the larger the increment and
- * therefore the lower the resolution
+ * @param dir +1 clockwise, -1 anti-clockwise
+ * @param accel acceleration factor for the delay increment
  */
-void encoder_IRQ_handler(uint gpio,uint32_t events){
-  int8_t dir = checkRotaryEncoder();
-    if (dir != 0){
-      //Update the Euclidean Fill value, which cannot
-      //be greater than the number of steps. OR less
-      //than 1.
-      if (dir == 1) {
-      glbEuclideanFill++;
-      if (glbEuclideanFill > EuclideanSteps[glbDivisor]) {
-          glbEuclideanFill = EuclideanSteps[glbDivisor];
-        }
-      }
-      else {
-        glbEuclideanFill--;
-        if (glbEuclideanFill < 1) {
-          glbEuclideanFill = 1;
-        }
-      } 
-      unsigned int retval = bjorklund(EuclideanSteps[glbDivisor],glbEuclideanFill);
-      printf("Steps: %d, Hits: %d, RetVal:"WORD16_PATTERN"\n",EuclideanSteps[glbDivisor],glbEuclideanFill,WORD16_TO_BINARY(retval));
-      //note the 'hits' within the EuclideanHits array
-      //clear it out first
-      for(int i=0; i<16; i++) {EuclideanHits[i]=0;}
-      //Then set each 'hit' according to the retval bit patters
-      for(int i=0;i<EuclideanSteps[glbDivisor];i++){
-        EuclideanHits[i] = bitRead(retval,(EuclideanSteps[glbDivisor]-i)-1);
-      } 
-      for(int i=0;i<EuclideanSteps[glbDivisor];i++){
-        printf("%d",EuclideanHits[i]);
-      }
-      printf("\n");
+static void encoderDetent(int dir, uint32_t accel){
+    //Update the Euclidean Fill value, which cannot
+    //be greater than the number of steps. OR less
+    //than 1. The divisor may have cut the number of
+    //steps since the last detent, so start from there
+    int steps = EuclideanSteps[glbDivisor];
+    int fill = MIN(glbEuclideanFill, steps) + dir;
+    glbEuclideanFill = MAX(1, MIN(fill, steps));
     // Only alter the delay if we're free-running
     if (SyncFree == 0){
-      // Increment depends on the current increment value
-      // TODO: probably play with these thresholds and
-      // increments to arrive at something meaningful
-
       // Left Channel
-      switch(targetDelay_L){
-        case 0 ... 10:
-          glbIncrement = 10;
-        break;
-        case 11 ... 100:
-          glbIncrement = 10;
-        break;
-        case 101 ... 1000:
-          glbIncrement = 10;
-        break;
-        case 1001 ... 10000:
-          glbIncrement = 100;
-        break;
-        case 10001 ... 100000:
-          glbIncrement = 1000;
-        break;
-        case 100001 ... 1000000:
-          glbIncrement = 10000;
-        break;
-        case 1000001 ... 10000000:
-          glbIncrement = 100000;
-        break;
-        default:
-          glbIncrement = 48000;
-      }
+      glbIncrement = encoderIncrement(targetDelay_L) * accel;
       if ((glbAlgorithm != 3) && (glbAlgorithm != 7)){
         // If Algorithm = 3 or 7, don't change Left channel
         if (dir == 1){
@@ -203,35 +291,11 @@ void encoder_IRQ_handler(uint gpio,uint32_t events){
       }
       // At very large increments it takes the glbDelay a long time to 
       // reach the target, so just bump it
-      if (glbIncrement > 10000) glbDelay_L = targetDelay_L;
+      if (glbIncrement > 10000) DelayJump_L++;
       //printf("Increment: %d, Target Delay Left: %d\n",glbIncrement, targetDelay_L);
 
       // Right Channel
-      switch(targetDelay_R){
-        case 0 ... 10:
-          glbIncrement = 10;
-        break;
-        case 11 ... 100:
-          glbIncrement = 10;
-        break;
-        case 101 ... 1000:
-          glbIncrement = 10;
-        break;
-        case 1001 ... 10000:
-          glbIncrement = 100;
-        break;
-        case 10001 ... 100000:
-          glbIncrement = 1000;
-        break;
-        case 100001 ... 1000000:
-          glbIncrement = 10000;
-        break;
-        case 1000001 ... 10000000:
-          glbIncrement = 100000;
-        break;
-        default:
-          glbIncrement = 48000;
-      }
+      glbIncrement = encoderIncrement(targetDelay_R) * accel;
       if ((glbAlgorithm != 2) && (glbAlgorithm != 7)){
         // If Algorithm = 2 or 7, DON'T change Right channel
         if (dir == 1){
@@ -243,12 +307,158 @@ void encoder_IRQ_handler(uint gpio,uint32_t events){
       }
       // At very large increments it takes the glbDelay a long time to 
       // reach the target, so just bump it
-      if (glbIncrement > 10000) glbDelay_R = targetDelay_R;
+      if (glbIncrement > 10000) DelayJump_R++;
       //printf("Increment: %d, Target Delay Right: %d\n",glbIncrement, targetDelay_R);
-
+    }
+}
+/**
+ * @brief act on the Rotary Encoder detents picked up by one poll
+ * 
+ * @param detents detents turned, + clockwise, - anti-clockwise
+ * @param time time the detents were picked up (time_us_32)
+ */
+static void encoderStep(int8_t detents, uint32_t time){
+    uint32_t count = abs(detents);
+    if (count == 0) return;
+    uint32_t accel = encoderAcceleration(time, count);
+    int dir = (detents > 0) ? 1 : -1;
+    for (uint32_t n = 0; n < count; n++) encoderDetent(dir, accel);
+}
+/**
+ * @brief apply everything the GPIO IRQ has queued since the last pass
+ */
+void processUIEvents(){
+  ui_event e;
+  while (popUIEvent(&e)){
+    switch (e.type){
+      case UI_EVENT_ENCODER:
+        encoderStep(e.value, e.time);
+        break;
+      default:
+        break;
     }
   }
 }
+/**
+ * @brief start the PIO timestamping of the external clock input
+ * 
+ * Must come after initEncoder(), whose program has to be at offset 0
+ */
+static void initClockTimestamp(){
+    uint offset = pio_add_program(pio2, &clock_timestamp_program);
+    ClockSM = pio_claim_unused_sm(pio2, true);
+    clock_timestamp_program_init(pio2, ClockSM, offset, CLOCK_IN);
+    ClockCyclesPerUs = (double)clock_get_hz(clk_sys) / 1000000.0;
+    ClockStampValid = false;
+    ClockIntervalCount = 0;
+    TempoPeriod = 0;
+}
+/**
+ * @brief median of the last 3 clock intervals
+ */
+static uint32_t clockIntervalMedian(){
+    uint32_t a = ClockIntervals[0], b = ClockIntervals[1], c = ClockIntervals[2];
+    if (a > b) {uint32_t t = a; a = b; b = t;}
+    if (b > c) b = c;
+    return (a > b) ? a : b;
+}
+/**
+ * @brief track the tempo of the external clock
+ * 
+ * Each edge interval goes through a 3-tap median filter, which throws
+ * out single glitches or missed edges without the lag of a long moving
+ * average. If the median moves away from the tracked period by more
+ * than EXTCLOCK_RELOCK the tracker re-locks straight onto it, which
+ * follows a tempo change within 2 beats. Otherwise an alpha-beta PLL
+ * locks onto the edges themselves, so the edge jitter averages out
+ * into a sub-microsecond period estimate.
+ * 
+ * @param interval cycles since the previous edge
+ */
+static void trackTempo(uint32_t interval){
+    ClockIntervals[ClockIntervalPtr++] = interval;
+    if (ClockIntervalPtr >= 3) ClockIntervalPtr = 0;
+    if (ClockIntervalCount < 3) ClockIntervalCount++;
+    double median = (ClockIntervalCount < 3) ? interval : clockIntervalMedian();
+    if ((TempoPeriod == 0) || (fabs(median - TempoPeriod) > (TempoPeriod * EXTCLOCK_RELOCK))){
+        TempoPeriod = median;
+        TempoOffset = 0;
+    } else if (fabs(interval - median) > (median * EXTCLOCK_OUTLIER)){
+        // ignore this edge, and re-align the phase to it
+        TempoOffset = 0;
+    } else {
+        double error = interval - (TempoOffset + TempoPeriod);
+        TempoPeriod += EXTCLOCK_PLL_BETA * error;
+        TempoOffset = -(1.0 - EXTCLOCK_PLL_ALPHA) * error;
+    }
+    ExtClockCycles = (uint32_t)(TempoPeriod + 0.5);
+    ExtClockPeriod = (int32_t)((TempoPeriod / ClockCyclesPerUs) + 0.5);
+    ClockEdgePending = true;
+}
+/**
+ * @brief re-calculate the sync'd delay at an external clock edge
+ * 
+ * The delay is the tracked clock period scaled by the divisor, worked
+ * out in whole samples from the frame length the I2S dividers actually
+ * give, so there is no float rounding and no assumed sample rate. It is
+ * only looked at once per edge, and only applied if it has moved by
+ * more than 1/SyncDelayHysteresis of the current delay, so clock jitter
+ * doesn't make the delay wander. Being relative, the threshold stays
+ * well under a real tempo change at short delays as well as long ones.
+ */
+static void updateSyncDelay(){
+    if (!ClockEdgePending) return;
+    ClockEdgePending = false;
+    if ((ExtClockCycles == 0) || (FrameCyclesQ8 == 0)) return;
+    int divisor = glbDivisor;
+    uint64_t num = ((uint64_t)ExtClockCycles << 8) * DivisorNum[divisor];
+    uint64_t den = (uint64_t)FrameCyclesQ8 * DivisorDen[divisor];
+    uint32_t delay = (uint32_t)((num + (den / 2)) / den);
+    if (delay > BUF_LEN) delay = BUF_LEN;
+    if (delay < 1) delay = 1;
+    uint32_t diff = (delay > targetDelay_L) ? (delay - targetDelay_L) : (targetDelay_L - delay);
+    uint32_t threshold = MAX(targetDelay_L / SyncDelayHysteresis, SyncDelayHysteresisMin);
+    if (diff > threshold){
+        PreviousClockPeriod = ExtClockPeriod;
+        targetDelay_L = delay;
+        targetDelay_R = delay;
+    }
+}
+/**
+ * @brief pick up the external clock edges timestamped by the PIO
+ * 
+ * Called from the core1 main loop. If no edge has been seen for
+ * EXTCLOCK_TIMEOUT, the PIO timebase may have wrapped so the next
+ * edge starts the measurement again rather than giving a bogus interval
+ */
+static void updateExtClock(){
+    while (!pio_sm_is_rx_fifo_empty(pio2, ClockSM)){
+        uint32_t stamp = pio_sm_get(pio2, ClockSM);
+        uint64_t now = time_us_64();
+        if (ClockStampValid && (now - ClockLastStampTime < EXTCLOCK_TIMEOUT)){
+            trackTempo(((stamp - ClockLastStamp) * 3) + 1);
+        } else {
+            ClockIntervalCount = 0;
+        }
+        ClockLastStamp = stamp;
+        ClockLastStampTime = now;
+        ClockStampValid = true;
+    }
+}
+/**
+ * @brief arm a timer alarm for an absolute deadline
+ * 
+ * The alarm only fires when the timer passes its exact value, so if the
+ * deadline has already gone by (a long IRQ stall) the interrupt is
+ * forced instead, and the missed event is made up straight away
+ * 
+ * @param alarm timer alarm number
+ * @param target timer value (uS) to fire at
+ */
+static void alarm_arm_at(uint alarm, uint32_t target) {
+  timer_hw->alarm[alarm] = target;
+  if ((int32_t)(target - timer_hw->timerawl) <= 0) hw_set_bits(&timer_hw->intf, 1u << alarm);
+}
 /**
  * @brief event handler for the incoming clock IRQ
  * this is normalled from the internal clock via the 
@@ -260,52 +470,44 @@ void encoder_IRQ_handler(uint gpio,uint32_t events){
  * Interrupt 
  */
 void clock_callback(uint gpio, uint32_t events){
-    // All interrupts end up here, so Check which gpio
-    // triggered the interrupt and dispatch accordingly
-    if ((gpio == ENCODERA_IN) || (gpio == ENCODERB_IN)) encoder_IRQ_handler(gpio, events);
-    else{
+    uint32_t IrqStart = cycle_count();
+    // All GPIO interrupts end up here, so Check which gpio
+    // triggered the interrupt
+    if ((1u << gpio) & SWITCH_GPIO_MASK){
+      // Algorithm / Divisor switch moved - (re)start the debounce
+      alarm_arm_at(SWITCH_ALARM_NUM, timer_hw->timerawl + (uint32_t)DeBounceTime);
+    } else if (gpio == CLOCK_IN){
     // Blink the on-board LED in phase with the incoming clock
     gpio_put(ONBOARD_LED,!gpio_get(CLOCK_IN));
-    // Note the clock period on rising edge trigger
-    // this avoids issues with duty cycle or PWM
+    // The clock period itself is measured by the PIO (see updateExtClock)
     // TODO - due to the Inverting input buffer, maybe
     // this should be triggered on the Falling Edge??
     if (events & GPIO_IRQ_EDGE_RISE) {
-      // It took ages to find a way of persuading the GCC compiler
-      // to let a Global variable be updated from within an ISR - it
-      // kept optimising it out. Usual method seems to be to declare
-      // the globals as Volatile, but that didn't work, but finally
-      // I discovered that declaring them as Atomic did!!
-      uint32_t ThisTick = time_us_32();
-      ExtClockPeriod = ThisTick - ExtClockTick;
-      ExtClockTick = ThisTick;
-      // run it through a Moving Average buffer to reduce abrupt changes
-      ExtClock_MA_Sum = ExtClock_MA_Sum - ExtClock_MA[ExtClock_MA_Ptr] + ExtClockPeriod;
-      ExtClock_MA[ExtClock_MA_Ptr++] = ExtClockPeriod;
-      if(ExtClock_MA_Ptr >=  ExtClock_MA_Len) ExtClock_MA_Ptr = 0;
-      ExtClockPeriod = ExtClock_MA_Sum / ExtClock_MA_Len;
       LEDPhase = !LEDPhase;
     }
   }
-}
-/**
- * @brief arm the internal clock interrupt
- */
-static void alarm_in_us_arm(uint32_t ClockPeriod_us) {
-  uint64_t target = timer_hw->timerawl + ClockPeriod_us;
-  timer_hw->alarm[ALARM_NUM] = (uint32_t)target;
+  uint32_t IrqCycles = cycle_count() - IrqStart;
+  if (IrqCycles > GpioIrqMaxCycles) GpioIrqMaxCycles = IrqCycles;
 }
 /**
  * @brief toggles the CLOCK_OUT gpio pin then
- * re-arms the Clock Timer according to the current
- * clock period, which is a global variable adjusted
- * via the clock ADC.
+ * re-arms the Clock Timer for the next edge
+ * 
+ * Each deadline is the previous deadline plus the half-period, not
+ * the time now plus the half-period, so IRQ latency never builds up
+ * into drift. The half-period is kept in 1/4096 uS, so the fraction
+ * of a uS carries over too and the average period is exact.
  */
 static void alarm_irq(void) {
+  hw_clear_bits(&timer_hw->intf, 1u << ALARM_NUM);
   hw_clear_bits(&timer_hw->intr, 1u << ALARM_NUM);
-  alarm_in_us_arm(ClockPeriod);
   ClockPhase = !ClockPhase;
   gpio_put(CLOCK_OUT, ClockPhase);
+  uint32_t late = timer_hw->timerawl - (uint32_t)(ClockDeadlineQ12 >> 12);
+  if (late > ClockLateMax) ClockLateMax = late;
+  ClockEdges++;
+  ClockDeadlineQ12 += ClockPeriodQ12;
+  alarm_arm_at(ALARM_NUM, (uint32_t)(ClockDeadlineQ12 >> 12));
 }
 /**
  * @brief Set an alarm interrupt for the internal clock
@@ -314,74 +516,174 @@ static void alarm_irq(void) {
  * the timer fires, it repeatedly re-arms itself
  */
 static void alarm_in_us(uint32_t ClockPeriod_us) {
+  hardware_alarm_claim(ALARM_NUM);
+  ClockDeadlineQ12 = ((uint64_t)(timer_hw->timerawl + ClockPeriod_us)) << 12;
   hw_set_bits(&timer_hw->inte, 1u << ALARM_NUM);
   irq_set_exclusive_handler(ALARM_IRQ, alarm_irq);
   irq_set_enabled(ALARM_IRQ, true);
-  alarm_in_us_arm(ClockPeriod_us);
+  alarm_arm_at(ALARM_NUM, (uint32_t)(ClockDeadlineQ12 >> 12));
+}
+/**
+ * @brief raise the next core1 control tick
+ * 
+ * Ticks are on an absolute CONTROL_TICK_US grid like the internal
+ * clock, so the control rate doesn't drift with IRQ latency
+ */
+static void control_alarm_irq(void) {
+  hw_clear_bits(&timer_hw->intf, 1u << CONTROL_ALARM_NUM);
+  hw_clear_bits(&timer_hw->intr, 1u << CONTROL_ALARM_NUM);
+  ControlTickDue = ControlDeadline;
+  ControlTicks++;
+  ControlDeadline += CONTROL_TICK_US;
+  alarm_arm_at(CONTROL_ALARM_NUM, ControlDeadline);
+}
+/**
+ * @brief start the core1 control tick
+ */
+static void initControlTick(){
+  hardware_alarm_claim(CONTROL_ALARM_NUM);
+  ControlDeadline = timer_hw->timerawl + CONTROL_TICK_US;
+  hw_set_bits(&timer_hw->inte, 1u << CONTROL_ALARM_NUM);
+  irq_set_exclusive_handler(CONTROL_ALARM_IRQ, control_alarm_irq);
+  irq_set_enabled(CONTROL_ALARM_IRQ, true);
+  alarm_arm_at(CONTROL_ALARM_NUM, ControlDeadline);
+}
+/**
+ * @brief sleep until the next control tick is due
+ * 
+ * Interrupts are masked while checking, so a tick that arrives just
+ * before the WFI still wakes it (a pending interrupt ends WFI even when
+ * masked) rather than being slept through. Records how late the tasks
+ * start against the tick deadline, and counts any ticks that were
+ * missed because the previous one overran.
+ * 
+ * @return the control tick to run
+ */
+static uint32_t waitControlTick(){
+    uint32_t ints = save_and_disable_interrupts();
+    while (ControlTicks == ControlTickDone){
+        __wfi();
+        // let whatever woke us run before checking again
+        restore_interrupts(ints);
+        ints = save_and_disable_interrupts();
+    }
+    uint32_t ticks = ControlTicks;
+    uint32_t late = timer_hw->timerawl - ControlTickDue;
+    restore_interrupts(ints);
+    if (late > ControlJitterMax) ControlJitterMax = late;
+    ControlOverruns += ticks - ControlTickDone - 1;
+    ControlTickDone = ticks;
+    return ticks;
+}
+/**
+ * @brief start free-running acquisition of the three pots
+ * 
+ * The ADC converts ADC0..2 round-robin into its FIFO at POT_ADC_RATE,
+ * and a pair of DMA channels (same arrangement as the I2S input)
+ * drains the FIFO into the PotSamples ring forever, so nothing on
+ * core1 ever has to wait for a conversion
+ */
+static void initPots(){
+    adc_init();
+    adc_gpio_init(FEEDBACK_PIN);    //ADC 0
+    adc_gpio_init(CLOCKSPEED_PIN);  //ADC 1
+    adc_gpio_init(WETDRY_PIN);      //ADC 2
+    // Round-robin starts from the selected input, so slot n of
+    // PotSamples always holds ADC input (n % POT_ADC_CHANNELS)
+    adc_select_input(0);
+    adc_set_round_robin((1u << POT_ADC_CHANNELS) - 1);
+    // FIFO on, DREQ on every sample, no error bit, full 12-bit samples
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv(((float)clock_get_hz(clk_adc) / POT_ADC_RATE) - 1.0f);
+
+    PotDmaData = dma_claim_unused_channel(true);
+    PotDmaCtrl = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(PotDmaCtrl);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    dma_channel_configure(PotDmaCtrl, &c, &dma_hw->ch[PotDmaData].al2_write_addr_trig, &PotSamplesAddr, 1, false);
+
+    c = dma_channel_get_default_config(PotDmaData);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_dreq(&c, DREQ_ADC);
+    channel_config_set_chain_to(&c, PotDmaCtrl);
+    dma_channel_configure(PotDmaData, &c, PotSamples, &adc_hw->fifo, count_of(PotSamples), false);
+
+    dma_channel_start(PotDmaCtrl);
+    adc_run(true);
+    // first values are due once the ring has been filled
+    PotPublishTime = time_us_64() + ((uint64_t)count_of(PotSamples) * 1000000) / POT_ADC_RATE;
 }
 /**
- * @brief check the Feedback Pot ADC input and update
- * the global Feedback amount parameters. This updates
- * a moving average figure to try and eliminate or at
- * least reduce the noise on the ADC input
+ * @brief decimate the pot samples down to one value per pot
+ * 
+ * Every CONTROL_POT_DIV control ticks the ring is summed per pot, which
+ * is a POT_OVERSAMPLE-long boxcar over the most recent samples
+ * (6.4ms at 10kHz), then scaled back to 12 bits. Slots being
+ * overwritten while we sum are simply newer samples, so the DMA
+ * never needs stopping.
+ * 
+ * @return true if new values were published this pass
+ */
+static bool updatePots(){
+    // wait for the ring to fill before the first values are published
+    if (time_us_64() < PotPublishTime) return false;
+    uint32_t Sum[POT_ADC_CHANNELS] = {0};
+    for (uint i = 0; i < count_of(PotSamples); i += POT_ADC_CHANNELS){
+        for (uint ch = 0; ch < POT_ADC_CHANNELS; ch++) Sum[ch] += PotSamples[i + ch];
+    }
+    Feedback_Average = (Sum[ADC_feedback] + POT_OVERSAMPLE/2) / POT_OVERSAMPLE;
+    Clock_Average = (Sum[ADC_Clock] + POT_OVERSAMPLE/2) / POT_OVERSAMPLE;
+    WetDry_Average = (Sum[ADC_WetDry] + POT_OVERSAMPLE/2) / POT_OVERSAMPLE;
+    return true;
+}
+/**
+ * @brief act on the decimated Feedback Pot value and update
+ * the global Feedback amount parameters
  */
 void updateFeedback(){
-      adc_select_input(ADC_feedback);
-      sleep_ms(1);  //  settling time
-      uint16_t  Feedback_raw = adc_read();
-      // Run this through a moving average buffer
-      Feedback_MA_Sum = Feedback_MA_Sum - Feedback_MA[Feedback_MA_Ptr] + Feedback_raw;
-      Feedback_MA[Feedback_MA_Ptr++] = Feedback_raw;
-      if(Feedback_MA_Ptr >=  Feedback_MA_Len) Feedback_MA_Ptr = 0;
-      Feedback_Average = Feedback_MA_Sum / Feedback_MA_Len;
+      // Ignore ADC noise - only act once the pot has actually moved, which
+      // saves recalculating the reverb coefficients on every pass
+      if (abs((int)Feedback_Average - Feedback_Applied) <= POT_HYSTERESIS) return;
+      Feedback_Applied = Feedback_Average;
       glbFeedback = Feedback_Average * Feedback_scale;
       // ensure we have a good solid 1.0 and 0.0
       // TODO: Check these thresholds!!
       if (glbFeedback > 0.97) glbFeedback = 1.0;
       if (glbFeedback < 0.01) glbFeedback = 0.0;
-      // use this value to update the gverb -> reverbtime (scale of 0 to 10?)
-      gverb_set_revtime(parrot_gverb, glbFeedback * 10.0f);
-      fv_set_roomsize(&parrot_freeverb,glbFeedback);
-      pv_set_roomsize(&parrot_pverb,glbFeedback);
-      //printf("Raw: %d, Average = %d, Feedback: %f\n",Feedback_raw, Feedback_Average, glbFeedback);
+      // use this value to update the gverb -> reverbtime (0 to GVERB_MAXREVTIME seconds)
+      // The FDN gains are worked out here, core0 just copies the result in
+      NextReverbCoeffs.revtime = glbFeedback * GVERB_MAXREVTIME;
+      NextReverbCoeffs.gverb_alphalog2 = gverb_calc_revtime(parrot_gverb, NextReverbCoeffs.revtime, NextReverbCoeffs.gverb_fdngains);
+      NextReverbCoeffs.roomsize = glbFeedback;
+      NextReverbCoeffs.changed |= REVERB_ROOM;
+      //printf("Average = %d, Feedback: %f\n",Feedback_Average, glbFeedback);
 }
 /**
- * @brief Checks the Clock Pot ADC input and updates
- * the global Internal Clock Speed. This updates
- * a moving average figure to try and eliminate or at
- * least reduce the noise on the ADC input
+ * @brief act on the decimated Clock Pot value and update
+ * the global Internal Clock Speed
  */
 void updateClock(){
-      adc_select_input(ADC_Clock);
-      sleep_ms(1);  //  settling time
-      uint16_t  Clock_raw = adc_read();
-      //printf("Clock Raw: %d\n",Clock_raw);
-      // Run this through a moving average buffer
-      Clock_MA_Sum = Clock_MA_Sum - Clock_MA[Clock_MA_Ptr] + Clock_raw;
-      Clock_MA[Clock_MA_Ptr++] = Clock_raw;
-      if(Clock_MA_Ptr >=  Clock_MA_Len) Clock_MA_Ptr = 0;
-      Clock_Average = Clock_MA_Sum / Clock_MA_Len;
       // Round the BPM values to 0.5 BPM accuracy to prevent clock drift
       // Do this by doubling, rounding then halving
       ClockBPM = round((40 + (Clock_Average * ClockScale)) * 2)/2;
       ClockFreq = (ClockBPM/60)*2;
       ClockPeriod = 1000000/ClockFreq;  
+      // The alarm IRQ only ever sees the fixed-point half-period, which
+      // is a single 32-bit write so it can't be caught half-updated
+      ClockPeriodQ12 = (uint32_t)((ClockPeriod * 4096.0) + 0.5);
 }
 /**
- * @brief check the value of the wet/dry pot and 
- * update the global Wet and Dry values. Raw values
- * are run through a moving average buffer in order 
- * to reduce noise
+ * @brief act on the decimated wet/dry pot value and 
+ * update the global Wet and Dry values
  */
 void updateWetDry(){
-      adc_select_input(ADC_WetDry);
-      sleep_ms(1);  //  settling time
-      uint16_t  WetDry_raw = adc_read();
-      // Run this through a moving average buffer
-      WetDry_MA_Sum = WetDry_MA_Sum - WetDry_MA[WetDry_MA_Ptr] + WetDry_raw;
-      WetDry_MA[WetDry_MA_Ptr++] = WetDry_raw;
-      if(WetDry_MA_Ptr >=  WetDry_MA_Len) WetDry_MA_Ptr = 0;
-      WetDry_Average = WetDry_MA_Sum / WetDry_MA_Len;
+      if (abs((int)WetDry_Average - WetDry_Applied) <= POT_HYSTERESIS) return;
+      WetDry_Applied = WetDry_Average;
       // Convert this to a floating point scale of 0...1
       glbWet = (WetDry_Average * WetDry_Scale)/100;
       // ensure we have a good solid 1.0 and 0.0
@@ -389,79 +691,122 @@ void updateWetDry(){
       if (glbWet > 0.97) glbWet = 1.0;
       if (glbWet < 0.05) glbWet = 0.0;
       glbDry = 1 - glbWet;
-      fv_set_dry(&parrot_freeverb,glbDry);
-      fv_set_wet(&parrot_freeverb,glbWet);
-      pv_set_dry(&parrot_pverb,glbDry);
-      pv_set_wet(&parrot_pverb,glbWet);
+      NextReverbCoeffs.wet = glbWet;
+      NextReverbCoeffs.dry = glbDry;
+      NextReverbCoeffs.changed |= REVERB_WETDRY;
 
-      //printf("Raw: %d, Average = %d, Wet: %f, Dry: %f\n",WetDry_raw, WetDry_Average, glbWet, glbDry);
+      //printf("Average = %d, Wet: %f, Dry: %f\n",WetDry_Average, glbWet, glbDry);
 }
 /**
- * @brief read the 3-Bit BCD value from the Algorithm switch
+ * @brief hand any changed reverb coefficients over to core0
  * 
- * This implements a software de-bounce, which looks for any
- * change to be stable for at least 200ms before deciding that
- * it can be trusted
+ * The set is copied into the half of the ReverbCoeffs double
+ * buffer that core0 is not using, then published. If core0 has
+ * not yet picked up the previous set, we leave it until the
+ * next pass, so core0 never reads a set while it is being written
  */
-void updateAlgorithm(){
-  uint32_t thisAlgorithm = gpio_get_all();
-  thisAlgorithm &= 0x7;  
+void publishReverbCoeffs(){
+      if (NextReverbCoeffs.changed == 0) return;
+      if (ReverbCoeffsPending >= 0) return;
+      ReverbCoeffs[ReverbCoeffsWriteIdx] = NextReverbCoeffs;
+      ReverbCoeffsPending = ReverbCoeffsWriteIdx;
+      ReverbCoeffsWriteIdx ^= 1;
+      NextReverbCoeffs.changed = 0;
+}
+/**
+ * @brief publish the control parameters for core0
+ * 
+ * Gathers everything the audio path needs into one snapshot and, if
+ * anything has changed, writes it to SharedParams under a seqlock:
+ * the sequence number is odd while the copy is being written, so
+ * core0 can tell a torn read and keep its previous snapshot instead.
+ * Only called from the core1 main loop, so there is a single writer.
+ */
+void publishParams(){
+      static parrot_params Published = {.dry = 1, .feedback = 0.1, .euclid_fill = 1};
+      parrot_params next;
+      // The encoder IRQ sets a new target before bumping the jump count,
+      // so read the jumps first: a jump is then never seen without its target
+      next.jump_L = DelayJump_L;
+      next.jump_R = DelayJump_R;
+      next.targetDelay_L = targetDelay_L;
+      next.targetDelay_R = targetDelay_R;
+      next.wet = glbWet;
+      next.dry = glbDry;
+      next.feedback = glbFeedback;
+      next.algorithm = glbAlgorithm;
+      next.divisor = glbDivisor;
+      // the fill can't be more than the steps of this divisor, so the pair
+      // is always a valid index into the Euclidean pattern table
+      next.euclid_fill = MIN(glbEuclideanFill, EuclideanSteps[next.divisor]);
+      // the right pattern is rotated into the gaps of the left one
+      next.euclid_rotation = euclid_rotation(EuclideanSteps[next.divisor], next.euclid_fill);
+      if (memcmp(&next, &Published, sizeof(next)) == 0) return;
+      Published = next;
+      uint32_t seq = atomic_load_explicit(&SharedParamsSeq, memory_order_relaxed);
+      atomic_store_explicit(&SharedParamsSeq, seq + 1, memory_order_relaxed);
+      atomic_thread_fence(memory_order_release);
+      SharedParams = next;
+      atomic_store_explicit(&SharedParamsSeq, seq + 2, memory_order_release);
+}
+/**
+ * @brief commit the 3-Bit BCD value from the Algorithm switch
+ * 
+ * @param thisAlgorithm debounced switch value
+ */
+static void commitAlgorithm(uint32_t thisAlgorithm){
   if (thisAlgorithm > 7) thisAlgorithm = 7;
-  if ((int)thisAlgorithm != LatestAlgorithm) {
-    LatestAlgorithm = thisAlgorithm;
-    AlgorithmChangedTime = time_us_64();
-  } else {
-    if (time_us_64() >= AlgorithmChangedTime + DeBounceTime){
-      // we can trust this value, so set the global if different
-      if (glbAlgorithm != (int)thisAlgorithm) {
-        //todo poss protect with spinlocks?
-        glbAlgorithm = (int)thisAlgorithm;
-        //printf("Algorithm = %d\n",glbAlgorithm); 
-      }
-    }
+  if (glbAlgorithm != (int)thisAlgorithm) {
+    glbAlgorithm = (int)thisAlgorithm;
+    //printf("Algorithm = %d\n",glbAlgorithm); 
   }
 }
 
 /**
- * @brief read the 4-Bit BCD value from the Divisor switch, read
+ * @brief commit the 4-Bit BCD value from the Divisor switch, read
  * the appropriate Divisor (multiple of the clock period) and set
  * the global divisor value accordingly
  * 
- * This implements a software de-bounce, which looks for any
- * change to be stable for at least 200ms before deciding that
- * it can be trusted
+ * @param thisDivisor debounced switch value
  */
-void updateDivisor(){
-  uint32_t thisDivisor = gpio_get_all();
-  thisDivisor = thisDivisor >> 3;             // shift so that gpio3 is LSB
-  thisDivisor &= 0xf;
+static void commitDivisor(uint32_t thisDivisor){
   if (thisDivisor > 15) thisDivisor = 15;
-  if ((int)thisDivisor != LatestDivisor) {
-    LatestDivisor = thisDivisor;
-    // note the time of the most recent change
-    DivisorChangedTime = time_us_64();
-  } else {
-    if (time_us_64() >= DivisorChangedTime + DeBounceTime){
-      // we can trust this value, so set the global if different
-      if (glbDivisor != (int)thisDivisor) {
-        //TODO poss protect with spinlocks?
-        glbDivisor = (int)thisDivisor;
-        glbRatio = divisors[thisDivisor];
-        //printf("Divisor = %d, Ratio = %f\n",glbDivisor, glbRatio); 
-        //whenever the divisor changes, check that the Fill number doesn't exceed
-        //the number of steps
-        if (glbEuclideanFill > EuclideanSteps[glbDivisor]) {glbEuclideanFill = EuclideanSteps[glbDivisor];}
-        unsigned int retval = bjorklund(EuclideanSteps[glbDivisor],glbEuclideanFill);
-        //note the 'hits' within the EuclideanHits array
-        //clear it out first
-        for(int i=0; i<12; i++) {EuclideanHits[i]=0;}
-        //Then set each 'hit' according to the retval bit patters
-        for(int i=0;i<EuclideanSteps[glbDivisor];i++){
-          EuclideanHits[i] = bitRead(retval,(EuclideanSteps[glbDivisor]-i)-1);
-        } 
-      }
-    }
+  if (glbDivisor != (int)thisDivisor) {
+    glbDivisor = (int)thisDivisor;
+    glbRatio = divisors[thisDivisor];
+    //printf("Divisor = %d, Ratio = %f\n",glbDivisor, glbRatio); 
+  }
+}
+
+/**
+ * @brief commit the Algorithm and Divisor switches once they have settled
+ * 
+ * Every edge on a switch pin pushes this one-shot alarm back to
+ * DeBounceTime from now, so it only fires once the switches have
+ * been still for that long, and the value read then can be trusted
+ */
+static void switch_alarm_irq(void) {
+  hw_clear_bits(&timer_hw->intf, 1u << SWITCH_ALARM_NUM);
+  hw_clear_bits(&timer_hw->intr, 1u << SWITCH_ALARM_NUM);
+  uint32_t switches = gpio_get_all();
+  commitAlgorithm(switches & 0x7);
+  commitDivisor((switches >> 3) & 0xf);             // shift so that gpio3 is LSB
+}
+/**
+ * @brief attach the Algorithm and Divisor switches to the debounce alarm
+ * 
+ * Must be called after the GPIO callback has been registered. The
+ * alarm is armed once straight away to pick up the initial positions
+ */
+static void initSwitches(){
+  hardware_alarm_claim(SWITCH_ALARM_NUM);
+  hw_set_bits(&timer_hw->inte, 1u << SWITCH_ALARM_NUM);
+  irq_set_exclusive_handler(SWITCH_ALARM_IRQ, switch_alarm_irq);
+  irq_set_enabled(SWITCH_ALARM_IRQ, true);
+  for (uint pin = 0; pin < 32; pin++){
+    if ((1u << pin) & SWITCH_GPIO_MASK) gpio_set_irq_enabled(pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
   }
+  alarm_arm_at(SWITCH_ALARM_NUM, timer_hw->timerawl + (uint32_t)DeBounceTime);
 }
 
 /**
@@ -498,11 +843,11 @@ void core1_entry(){
     // timers runs on Core 1 leaving Core 0 to run the
     // time-critical Audio I/O
     struct repeating_timer MainClock;
+    // Cycle counter used to time the GPIO IRQ on this core
+    cycle_counter_init();
     // Clock out and In
     ClockPhase = 0;
     LEDPhase = 0;
-    glbDelay_L = 0;
-    glbDelay_R = 0;
     gpio_init(CLOCK_IN);
     gpio_set_dir(CLOCK_IN, GPIO_IN);
     gpio_init(CLOCK_OUT);
@@ -512,13 +857,10 @@ void core1_entry(){
     gpio_set_dir(SYNC_FREE, GPIO_IN);
     SyncFree = 0;                   // Not sync'd to external clock until told otherwise
 
-    // Rotary Encoder
-    gpio_init(ENCODERA_IN);
-    gpio_set_dir(ENCODERA_IN,GPIO_IN);
-    gpio_pull_up(ENCODERA_IN);
-    gpio_init(ENCODERB_IN);
-    gpio_set_dir(ENCODERB_IN,GPIO_IN);
-    gpio_pull_up(ENCODERB_IN);
+    // Rotary Encoder - decoded by pio2
+    initEncoder();
+    // External clock edges - timestamped by pio2
+    initClockTimestamp();
     gpio_init(ENCODER_SW);
     gpio_set_dir(ENCODER_SW,GPIO_IN);
     gpio_pull_up(ENCODER_SW);
@@ -542,55 +884,20 @@ void core1_entry(){
     gpio_init(ALGORITHM_2);
     gpio_set_dir(ALGORITHM_2,GPIO_IN);
 
-    ExtClockTick = time_us_32();
-
     //Initialise the internal clock to 60BPM
     ClockBPM = 60;
     ClockFreq = (ClockBPM/60)*2;
     ClockPeriod = 1000000/ClockFreq;
+    ClockPeriodQ12 = (uint32_t)((ClockPeriod * 4096.0) + 0.5);
     alarm_in_us(ClockPeriod);
-    LatestDivisor = 0;
     glbDivisor = 0;
     glbRatio = 1.00;
-    DivisorChangedTime = time_us_64();
-    LatestAlgorithm = 0;
     glbAlgorithm = 0;
-    AlgorithmChangedTime = time_us_64();
+    ReverbReportTime = time_us_64();
+    IrqReportTime = time_us_64();
 
     //Initialise ADC Inputs
-    adc_init();
-    adc_gpio_init(FEEDBACK_PIN);    //ADC 0
-    adc_gpio_init(CLOCKSPEED_PIN);  //ADC 1
-    adc_gpio_init(WETDRY_PIN);      //ADC 2
-    // Prep the Feedback Moving Average buffer
-    for(Feedback_MA_Ptr=0;Feedback_MA_Ptr <= Feedback_MA_Len;Feedback_MA_Ptr++){
-      Feedback_MA[Feedback_MA_Ptr] = 0;
-    }
-    Feedback_MA_Ptr = 0;
-    Feedback_Average = 0;
-    Feedback_MA_Sum = 0;
-    // Prep the Clock Moving Average buffer
-    for(Clock_MA_Ptr=0;Clock_MA_Ptr <= Clock_MA_Len;Clock_MA_Ptr++){
-      Clock_MA[Clock_MA_Ptr] = 0;
-    }
-    Clock_MA_Ptr = 0;
-    Clock_Average = 0;
-    Clock_MA_Sum = 0;
-    // Prep the Wet/Dry Moving Average buffer
-    for(WetDry_MA_Ptr=0;WetDry_MA_Ptr <= WetDry_MA_Len;WetDry_MA_Ptr++){
-      WetDry_MA[WetDry_MA_Ptr] = 0;
-    }
-    WetDry_MA_Ptr = 0;
-    WetDry_Average = 0;
-    WetDry_MA_Sum = 0;
-
-    // Prep the Ext Clock Moving Average buffer
-    for(ExtClock_MA_Ptr=0;ExtClock_MA_Ptr <= ExtClock_MA_Len;ExtClock_MA_Ptr++){
-      ExtClock_MA[ExtClock_MA_Ptr] = 0;
-    }
-    ExtClock_MA_Ptr = 0;
-    ExtClock_Average = 0;
-    ExtClock_MA_Sum = 0;
+    initPots();
 
     // Attach IRQ to external clock input
     // Triggered on Rising AND Falling edges
@@ -598,36 +905,65 @@ void core1_entry(){
     // any subsequent IRQs need to be set with gpio_set_irq_enabled
     // Then this primary IRQ calls other functions depending on the pin.
     gpio_set_irq_enabled_with_callback(CLOCK_IN,0x0C,1,clock_callback);
-    // This attaches an IRQ to the encoder pins. Unfortunately
-    // there is only one IRQ Handler, which has to then dispatch
-    // calls based upon which GPIO triggered the interrupt 
-    gpio_set_irq_enabled(ENCODERA_IN,GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE,1);
-    gpio_set_irq_enabled(ENCODERB_IN,GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE,1);
-    // Main Loop
+    // Algorithm & Divisor switches are debounced from their edges
+    initSwitches();
+    // Main Loop - runs once per control tick, sleeping in between.
+    // Each task runs every so many ticks according to its divisor
+    initControlTick();
     while(1){
-      // Update the feedback amount
-      updateFeedback();
-      // check and adjust internal Clock speed
-      updateClock();
-      // check and adjust the Wet/Dry balance
-      updateWetDry();
+      uint32_t tick = waitControlTick();
+      uint32_t TickStart = cycle_count();
+      // pick up any encoder movement and act on it
+      pollEncoder();
+      processUIEvents();
+      // Pot values are decimated and acted upon at a fixed rate
+      if (((tick % CONTROL_POT_DIV) == 0) && updatePots()){
+        // Update the feedback amount
+        updateFeedback();
+        // check and adjust internal Clock speed
+        updateClock();
+        // check and adjust the Wet/Dry balance
+        updateWetDry();
+      }
+      // pass any new reverb coefficients to core0
+      publishReverbCoeffs();
       // Check the Status of the Sync / Free switch
-      updateSyncFree();
-      // check and update the Algoritm
-      updateAlgorithm();
-      // check and update the clock divisor
-      updateDivisor();
+      if ((tick % CONTROL_SWITCH_DIV) == 0) updateSyncFree();
+      // track the tempo of the external clock
+      updateExtClock();
       // If we are sync'd to External Clock then update the delay 
-      // based on the ExtClockPeriod
+      // at each clock edge, as some multiple or sub-multiple of the
+      // External Clock period (1*, 2* /2, /4 etc), according to the divisor
       if(SyncFree == 1){
-          // Target Delay will actually be some multiple or sub-multiple of the
-          // External Clock period (1*, 2* /2, /4 etc), according to the multiple selected  
-          PreviousClockPeriod = ExtClockPeriod;
-          targetDelay_L = (uint32_t)((float)ExtClockPeriod / SampleLength) * glbRatio;
-          //printf("Ext Clock Period %d, SampleLength %f, TargetDelay: %d, Divisor: %f\n", ExtClockPeriod, SampleLength,targetDelay, glbRatio);
-          //if (targetDelay_L > BUF_LEN) targetDelay_L = BUF_LEN;
-          targetDelay_R = targetDelay_L;
+          updateSyncDelay();
+      } else {
+          ClockEdgePending = false;
+      }
+      // hand the latest parameter set over to core0
+      publishParams();
+      if ((tick % CONTROL_TELEMETRY_DIV) == 0){
+#ifdef PARROT_BENCHMARK
+        // Report the cost of pverb while it is selected
+        if ((PV_REPORT_INTERVAL > 0) && (glbAlgorithm == 4) && (time_us_64() >= ReverbReportTime + PV_REPORT_INTERVAL)){
+            if (pv_report(&parrot_pverb)) ReverbReportTime = time_us_64();
+        }
+        // Report the longest GPIO IRQ since the last report
+        if (time_us_64() >= IrqReportTime + IRQ_REPORT_INTERVAL){
+            IrqReportTime = time_us_64();
+            printf("GPIO IRQ max %u cycles, %u UI events dropped\n", GpioIrqMaxCycles, UIEventsDropped);
+            GpioIrqMaxCycles = 0;
+            // CLOCK_OUT edges are scheduled on an absolute grid, so lateness
+            // against the deadline is also the drift against the timer
+            printf("Internal clock: %u edges, max %u uS from the timer\n", ClockEdges, ClockLateMax);
+            ClockLateMax = 0;
+            printf("Control tick: max %u uS late, max %u cycles busy, %u overruns\n", ControlJitterMax, ControlBusyMax, ControlOverruns);
+            ControlJitterMax = 0;
+            ControlBusyMax = 0;
+        }
+#endif
       }
+      uint32_t TickCycles = cycle_count() - TickStart;
+      if (TickCycles > ControlBusyMax) ControlBusyMax = TickCycles;
     }
 }
 
@@ -0,0 +1,234 @@
+/******************************************************************************
+
+The Camberwell Parrot
+
+Copyright © 2024 Richard R. Goodwin / Audio Morphology Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+******************************************************************************/
+/**
+ * @file parrot_euclid.c
+ * 
+ * Euclidean pattern table, and the Bjorklund generator it was made
+ * from. Kept free of any Pico SDK dependencies so that the table can
+ * be checked against the generator on the host (see tests/)
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include "parrot_euclid.h"
+
+/**
+ * C Equivalent of the Arduino bitRead() function
+ * 
+ * Bits beyond the width of an unsigned int read as 0, rather than
+ * relying on the shift count (undefined behaviour in C, and masked
+ * to 5 bits on both the M33 and x86)
+ */
+int bitRead(unsigned int value, unsigned int bit) {
+    if (bit >= (sizeof(value) * 8)) return 0;
+    return (value >> bit) & 1;
+}
+
+/**
+ * @brief find the binary length of a number
+ */
+static int findlength(unsigned int bnry){
+    bool lengthfound = false;
+    int length=1; // no number can have a length of zero - single 0 has a length of one, but no 1s for the sytem to count
+    for (int q=32;q>=0;q--){
+      int r=bitRead(bnry,q);
+      if(r==1 && lengthfound == false){
+        length=q+1;
+        lengthfound = true;
+      }
+    }
+    return length;
+  }
+
+/**
+ * @brief concatenate two binary numbers
+ */
+static unsigned int ConcatBin(unsigned int bina, unsigned int binb){
+    int binb_len=findlength(binb);
+    unsigned int sum=(bina<<binb_len);
+    sum = sum | binb;
+    return sum;
+  }
+
+
+/**
+ * @brief Euclidean patterns for every step count and fill value
+ * 
+ * Indexed [steps][fill], for 0 to EUCLID_MAX_STEPS steps. Each pattern is
+ * right-aligned, with the first step in bit (steps - 1). Entries where
+ * the fill is 0 or more than the number of steps are empty. 
+ * 
+ * Generated on the host from bjorklund() below, so that the patterns
+ * are looked up rather than calculated in the encoder IRQ
+ */
+static const uint16_t EuclideanPatterns[EUCLID_MAX_STEPS + 1][EUCLID_MAX_STEPS + 1] = {
+    {0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000},  // 0 steps
+    {0x000,0x001,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000},  // 1 steps
+    {0x000,0x002,0x003,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000},  // 2 steps
+    {0x000,0x004,0x006,0x007,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000},  // 3 steps
+    {0x000,0x008,0x00A,0x00E,0x00F,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000},  // 4 steps
+    {0x000,0x010,0x014,0x015,0x01E,0x01F,0x000,0x000,0x000,0x000,0x000,0x000,0x000},  // 5 steps
+    {0x000,0x020,0x024,0x02A,0x02D,0x03E,0x03F,0x000,0x000,0x000,0x000,0x000,0x000},  // 6 steps
+    {0x000,0x040,0x048,0x054,0x055,0x05B,0x07E,0x07F,0x000,0x000,0x000,0x000,0x000},  // 7 steps
+    {0x000,0x080,0x088,0x092,0x0AA,0x0B6,0x0BB,0x0FE,0x0FF,0x000,0x000,0x000,0x000},  // 8 steps
+    {0x000,0x100,0x110,0x124,0x154,0x155,0x16D,0x177,0x1FE,0x1FF,0x000,0x000,0x000},  // 9 steps
+    {0x000,0x200,0x210,0x248,0x252,0x2AA,0x2D6,0x2DB,0x2F7,0x3FE,0x3FF,0x000,0x000},  // 10 steps
+    {0x000,0x400,0x420,0x444,0x492,0x554,0x555,0x5B6,0x5DD,0x5EF,0x7FE,0x7FF,0x000},  // 11 steps
+    {0x000,0x800,0x820,0x888,0x924,0x94A,0xAAA,0xB5A,0xB6D,0xBBB,0xBEF,0xFFE,0xFFF}   // 12 steps
+};
+
+/**
+ * @brief look up the Euclidean pattern for a number of steps and a fill number
+ * 
+ * @param steps Total number of steps (1 .. EUCLID_MAX_STEPS)
+ * @param fill Number of 'Hits', clamped to the number of steps
+ * @return pattern, with the first step in bit (steps - 1)
+ */
+unsigned int euclid_bit_pattern(int steps, int fill){
+    if ((steps < 1) || (steps > EUCLID_MAX_STEPS)) return 0;
+    if (fill > steps) fill = steps;
+    if (fill < 0) fill = 0;
+    return EuclideanPatterns[steps][fill];
+}
+
+/**
+ * @brief how far to rotate the right channel's pattern from the left
+ * 
+ * Half the average spacing between hits, rounded up, so the right
+ * hits land in the gaps between the left ones. It follows the fill,
+ * and the two patterns only coincide when every step is a hit
+ * 
+ * @param steps Total number of steps (1 .. EUCLID_MAX_STEPS)
+ * @param fill Number of 'Hits'
+ * @return rotation in steps, 0 .. steps - 1
+ */
+int euclid_rotation(int steps, int fill){
+    if ((steps < 1) || (fill < 1) || (fill >= steps)) return 0;
+    return (steps + (2 * fill) - 1) / (2 * fill);
+}
+
+/**
+ * @brief calculate Euclidean fill, given a number of steps and a fill number
+ * 
+ * This uses the Bjorklund algorithm to calculate a pulse pattern given a number
+ * of steps and a fill value. The fill Value needs to be less than or equal to the 
+ * number of steps
+ * 
+ * This returns a 16-Bit unsigned Int binary pattern. Our maximum number of steps
+ * is 12, so 16-Bits will hold that quite adequately. The idea is that we pre-calculate
+ * all possible Step/Fill combinations.
+ * 
+ * This is a variation of Tom Whitwell's Euclidean Sequencer Arduino code 
+ * 
+ * Not used at run-time any more - it is kept as the reference that the
+ * EuclideanPatterns table was generated from
+ * 
+ * @param n Total number of steps
+ * @param k Number of 'Hits' to be evenly distibuted across the steps
+ */
+unsigned int bjorklund(int n, int k){
+    int pauses = n-k;
+    int pulses = k;
+    int per_pulse = pauses/k;
+    int remainder = pauses%pulses;  
+    unsigned int workbeat[n];
+    unsigned int outbeat;
+    int workbeat_count=n;
+    int a; 
+    int b; 
+    int trim_count;
+    for (a=0;a<n;a++){ // Populate workbeat with unsorted pulses and pauses 
+      if (a<pulses){
+        workbeat[a] = 1;
+      }
+      else {
+        workbeat [a] = 0;
+      }
+    }
+  
+    if (per_pulse>0 && remainder <2){ // Handle easy cases where there is no or only one remainer  
+      for (a=0;a<pulses;a++){
+        for (b=workbeat_count-1; b>workbeat_count-per_pulse-1;b--){
+          workbeat[a]  = ConcatBin(workbeat[a], workbeat[b]);
+        }
+        workbeat_count = workbeat_count-per_pulse;
+      }
+  
+      outbeat = 0; // Concatenate workbeat into outbeat - according to workbeat_count 
+      for (a=0;a < workbeat_count;a++){
+        outbeat = ConcatBin(outbeat,workbeat[a]);
+      }
+      return outbeat;
+    }
+  
+    else { 
+      int groupa = pulses;
+      int groupb = pauses; 
+      int iteration=0;
+      if (groupb<=1){
+      }
+      while(groupb>1){ //main recursive loop
+        if (groupa>groupb){ // more Group A than Group B
+          int a_remainder = groupa-groupb; // what will be left of groupa once groupB is interleaved 
+          trim_count = 0;
+          for (a=0; a<groupa-a_remainder;a++){ //count through the matching sets of A, ignoring remaindered
+            workbeat[a]  = ConcatBin (workbeat[a], workbeat[workbeat_count-1-a]);
+            trim_count++;
+          }
+          workbeat_count = workbeat_count-trim_count;
+          groupa=groupb;
+          groupb=a_remainder;
+        }
+        else if (groupb>groupa){ // More Group B than Group A
+          int b_remainder = groupb-groupa; // what will be left of group once group A is interleaved 
+          trim_count=0;
+          for (a = workbeat_count-1;a>=groupa+b_remainder;a--){ //count from right back through the Bs
+            workbeat[workbeat_count-a-1] = ConcatBin (workbeat[workbeat_count-a-1], workbeat[a]);
+            trim_count++;
+          }
+          workbeat_count = workbeat_count-trim_count;
+          groupb=b_remainder;
+        }
+        else if (groupa == groupb){ // groupa = groupb 
+          trim_count=0;
+          for (a=0;a<groupa;a++){
+            workbeat[a] = ConcatBin (workbeat[a],workbeat[workbeat_count-1-a]);
+            trim_count++;
+          }
+          workbeat_count = workbeat_count-trim_count;
+          groupb=0;
+        }
+        else {
+          //printf("ERROR");
+        }
+        iteration++;
+      }
+    outbeat = 0; // Concatenate workbeat into outbeat - according to workbeat_count 
+      for (a=0;a < workbeat_count;a++){
+        outbeat = ConcatBin(outbeat,workbeat[a]);
+      }
+      return outbeat;
+    }
+  }
@@ -0,0 +1,43 @@
+/******************************************************************************
+
+The Camberwell Parrot
+
+Copyright © 2024 Richard R. Goodwin / Audio Morphology Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+******************************************************************************/
+/**
+ * @file parrot_euclid.h
+ * 
+ * Euclidean patterns - included by parrot.h, and usable on its own
+ * by the host tests
+ */
+#ifndef PARROT_EUCLID_H
+#define PARROT_EUCLID_H
+
+#define EUCLID_MAX_STEPS 12                 // Longest Euclidean pattern (see EuclideanSteps[])
+
+// function prototypes - parrot_euclid.c
+unsigned int bjorklund(int,int);
+unsigned int euclid_bit_pattern(int,int);
+int euclid_rotation(int,int);
+int bitRead(unsigned int, unsigned int);
+
+#endif
@@ -29,6 +29,7 @@ SOFTWARE.
  * Various signal processing functions
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include "parrot.h"
 #include "psram_spi.h"
 #include "malloc.h"
@@ -38,7 +39,6 @@ SOFTWARE.
 
 #define FUZZ(x) CubicAmplifier(CubicAmplifier(CubicAmplifier(CubicAmplifier(x))))
 #define RTH(x) rational_tanh(x);
-uint32_t PrevTime, TimeNow;
 /**
  * @brief Get free RAM using static memory defines
  *        cf. https://forums.raspberrypi.com/viewtopic.php?t=347638#p2082565
@@ -54,6 +54,146 @@ size_t get_free_ram()
 }
 
 
+/**
+ * @brief read a contiguous run of bytes from PSRAM
+ * 
+ * Splits the run into as few SPI transactions as the PSRAM library and
+ * the APS6404L page size allow.
+ * 
+ * @param addr PSRAM byte address (32-Bit aligned)
+ * @param dst destination buffer in SRAM
+ * @param bytes number of bytes to read (multiple of 4)
+ * @return number of SPI transactions issued
+ */
+uint32_t psram_burst_read(uint32_t addr, void *dst, uint32_t bytes){
+    uint8_t *ptr = (uint8_t *)dst;
+    uint32_t transactions = 0;
+    while (bytes > 0){
+        uint32_t chunk = PSRAM_PAGE_SIZE - (addr & (PSRAM_PAGE_SIZE - 1));
+        if (chunk > PSRAM_READ_BURST_MAX) chunk = PSRAM_READ_BURST_MAX;
+        if (chunk > bytes) chunk = bytes;
+        PROFILE(PROF_PSRAM, psram_read(&psram_spi, addr, ptr, chunk));
+        addr += chunk;
+        ptr += chunk;
+        bytes -= chunk;
+        transactions++;
+    }
+    return transactions;
+}
+
+/**
+ * @brief write a contiguous run of bytes to PSRAM
+ * 
+ * @param addr PSRAM byte address (32-Bit aligned)
+ * @param src source buffer in SRAM
+ * @param bytes number of bytes to write (multiple of 4)
+ * @return number of SPI transactions issued
+ */
+uint32_t psram_burst_write(uint32_t addr, const void *src, uint32_t bytes){
+    const uint8_t *ptr = (const uint8_t *)src;
+    uint32_t transactions = 0;
+    while (bytes > 0){
+        uint32_t chunk = PSRAM_PAGE_SIZE - (addr & (PSRAM_PAGE_SIZE - 1));
+        if (chunk > PSRAM_WRITE_BURST_MAX) chunk = PSRAM_WRITE_BURST_MAX;
+        if (chunk > bytes) chunk = bytes;
+        PROFILE(PROF_PSRAM, psram_write(&psram_spi, addr, ptr, chunk));
+        addr += chunk;
+        ptr += chunk;
+        bytes -= chunk;
+        transactions++;
+    }
+    return transactions;
+}
+
+/**
+ * @brief read a block of samples from a circular float buffer in PSRAM
+ * 
+ * The buffer holds one 32-Bit float per sample. Reads that run off the
+ * end of the buffer carry on from its base address.
+ * 
+ * @param base PSRAM byte address of the start of the buffer
+ * @param size length of the buffer in samples
+ * @param idx index of the first sample to read
+ * @param dst destination buffer
+ * @param count number of samples to read (no more than size)
+ * @return number of SPI transactions issued
+ */
+uint32_t psram_ring_read(uint32_t base, uint32_t size, uint32_t idx, float *dst, uint32_t count){
+    uint32_t first = size - idx;
+    if (first >= count) return psram_burst_read(base + (idx << 2), dst, count << 2);
+    return psram_burst_read(base + (idx << 2), dst, first << 2)
+         + psram_burst_read(base, dst + first, (count - first) << 2);
+}
+
+/**
+ * @brief write a block of samples to a circular float buffer in PSRAM
+ * 
+ * @param base PSRAM byte address of the start of the buffer
+ * @param size length of the buffer in samples
+ * @param idx index of the first sample to write
+ * @param src source buffer
+ * @param count number of samples to write (no more than size)
+ * @return number of SPI transactions issued
+ */
+uint32_t psram_ring_write(uint32_t base, uint32_t size, uint32_t idx, const float *src, uint32_t count){
+    uint32_t first = size - idx;
+    if (first >= count) return psram_burst_write(base + (idx << 2), src, count << 2);
+    return psram_burst_write(base + (idx << 2), src, first << 2)
+         + psram_burst_write(base, src + first, (count - first) << 2);
+}
+
+
+/**
+ * @brief time gverb on the target
+ * 
+ * Runs a burst of noise followed by silence through the passed gverb
+ * instance, first a sample at a time with gverb_do (SRAM build only) then in
+ * GVERB_BENCH_BLOCK frame blocks with gverb_do_block, and prints the
+ * average and worst-case cycles per frame for each. The reverb is
+ * flushed before and after. Only built when PARROT_BENCHMARK is
+ * defined in CMakeLists.txt
+ * 
+ * @param p gverb instance
+ * @param frames number of frames to time
+ */
+#define GVERB_BENCH_BLOCK 48        // frames per block, as delivered by the I2S DMA
+void gverb_benchmark(ty_gverb *p, int frames){
+    static float x[GVERB_BENCH_BLOCK], yl[GVERB_BENCH_BLOCK], yr[GVERB_BENCH_BLOCK];
+    uint32_t total = 0;
+    uint32_t worst = 0;
+    gverb_flush(p);
+#if !GVERB_PSRAM
+    for (int i = 0; i < frames; i++){
+        float in = (i < 4800) ? ((float)(rand() & 0xFFFF) / 32768.0f) - 1.0f : 0.0f;
+        uint32_t start = cycle_count();
+        gverb_do(p, in, &yl[0], &yr[0]);
+        uint32_t elapsed = cycle_count() - start;
+        total += elapsed;
+        if (elapsed > worst) worst = elapsed;
+    }
+    printf("gverb_do: %lu cycles/frame average, %lu worst over %d frames\n",
+        (unsigned long)(total / frames), (unsigned long)worst, frames);
+    gverb_flush(p);
+#endif
+    total = 0;
+    worst = 0;
+    int blocks = frames / GVERB_BENCH_BLOCK;
+    for (int b = 0; b < blocks; b++){
+        for (int i = 0; i < GVERB_BENCH_BLOCK; i++){
+            x[i] = ((b * GVERB_BENCH_BLOCK) + i < 4800) ? ((float)(rand() & 0xFFFF) / 32768.0f) - 1.0f : 0.0f;
+        }
+        uint32_t start = cycle_count();
+        gverb_do_block(p, x, yl, yr, GVERB_BENCH_BLOCK);
+        uint32_t elapsed = cycle_count() - start;
+        total += elapsed;
+        if (elapsed > worst) worst = elapsed;
+    }
+    printf("gverb_do_block: %lu cycles/frame average, %lu worst (%lu per %d frame block)\n",
+        (unsigned long)(total / (blocks * GVERB_BENCH_BLOCK)),
+        (unsigned long)(worst / GVERB_BENCH_BLOCK), (unsigned long)worst, GVERB_BENCH_BLOCK);
+    gverb_flush(p);
+}
+
 /**
  * @brief wavefolder
  * 
@@ -99,40 +239,169 @@ float CubicAmplifier( float input )
     }
     return output;
 }
+/**
+ * @brief read a run of stereo frames from the main PSRAM delay buffer
+ * 
+ * Frames are L-R pairs, 8 bytes each. Runs that go off the end of the
+ * buffer carry on from the start.
+ * 
+ * @param idx index of the first frame
+ * @param dst destination, two samples per frame
+ * @param frames number of frames to read
+ * @return number of SPI transactions issued
+ */
+uint32_t psram_frames_read(uint32_t idx, union uSample *dst, uint32_t frames){
+    uint32_t first = (BUF_LEN + 1) - idx;
+    if (first >= frames) return psram_burst_read(idx << 3, dst, frames << 3);
+    return psram_burst_read(idx << 3, dst, first << 3)
+         + psram_burst_read(0, dst + (first * 2), (frames - first) << 3);
+}
+
+/**
+ * @brief write a run of stereo frames to the main PSRAM delay buffer
+ * 
+ * @param idx index of the first frame
+ * @param src source, two samples per frame
+ * @param frames number of frames to write
+ * @return number of SPI transactions issued
+ */
+uint32_t psram_frames_write(uint32_t idx, const union uSample *src, uint32_t frames){
+    uint32_t first = (BUF_LEN + 1) - idx;
+    if (first >= frames) return psram_burst_write(idx << 3, src, frames << 3);
+    return psram_burst_write(idx << 3, src, first << 3)
+         + psram_burst_write(0, src + (first * 2), (frames - first) << 3);
+}
+
+/**
+ * @brief add one pattern tap to the Euclidean plan
+ * 
+ * A tap at an offset that is already being read is folded into that
+ * read, so it costs no more PSRAM traffic
+ * 
+ * @param plan plan being built
+ * @param offset tap offset in frames
+ * @param IsLeft the tap reads the left (true) or right (false) channel
+ * @param gain tap gain
+ * @param pan tap position, -1.0 (left) to +1.0 (right)
+ */
+static void Euclidean_Plan_Tap(euclid_plan *plan, uint32_t offset, bool IsLeft, float gain, float pan){
+    int r;
+    for (r = 0; r < plan->numreads; r++){
+        if (plan->read[r].offset == offset) break;
+    }
+    if (r == plan->numreads){
+        plan->read[r].offset = offset;
+        plan->read[r].ll = plan->read[r].lr = 0.0f;
+        plan->read[r].rl = plan->read[r].rr = 0.0f;
+        plan->numreads++;
+    }
+    // equal power pan
+    float angle = (pan + 1.0f) * PI * 0.25f;
+    if (IsLeft){
+        plan->read[r].ll += gain * cosf(angle);
+        plan->read[r].lr += gain * sinf(angle);
+    } else {
+        plan->read[r].rl += gain * cosf(angle);
+        plan->read[r].rr += gain * sinf(angle);
+    }
+    plan->numtaps++;
+}
+
+/**
+ * @brief work out the reads, gains and pans for the current Euclidean patterns
+ * 
+ * Each step is an equal fraction of the delay time, and each 'hit'
+ * in the pattern is a tap at that step. The left pattern is timed from
+ * the left delay and reads the left channel, and the right pattern is
+ * the same pattern rotated by euclid_rotation() steps, so that its hits
+ * fall between the left ones, timed from the right delay and reading
+ * the right channel. The gain of each
+ * successive tap is decreased compared to the one before, and each
+ * successive tap is panned further out from the centre towards its
+ * own side.
+ */
+static void Euclidean_Plan(euclid_plan *plan, uint32_t delay_L, uint32_t delay_R, int divisor, int fill, int rotation){
+    int steps = EuclideanSteps[divisor];
+    unsigned int pattern = euclid_bit_pattern(steps, fill);
+    int rot = ((rotation % steps) + steps) % steps;
+    plan->delay_L = delay_L;
+    plan->delay_R = delay_R;
+    plan->divisor = divisor;
+    plan->fill = fill;
+    plan->rotation = rotation;
+    plan->numtaps = 0;
+    plan->numreads = 0;
+    for (int channel = 0; channel < 2; channel++){
+        bool IsLeft = (channel == 0);
+        //!!TODO should this be ((delay / ratio) / steps) - 1.0, or even +1??
+        uint32_t StepDelay = (uint32_t)(((float)(IsLeft ? delay_L : delay_R) / (float)steps) / divisors[divisor]);
+        float TapGain = 1.0f;
+        float TapPan = 0.0f;
+        for (int thisStep = 0; thisStep < steps; thisStep++){
+            //check whether this step is a 'hit', the right pattern being rotated
+            int patternStep = IsLeft ? thisStep : (thisStep + steps - rot) % steps;
+            if (bitRead(pattern, (steps - patternStep) - 1)){
+                Euclidean_Plan_Tap(plan, StepDelay * thisStep, IsLeft, TapGain, IsLeft ? -TapPan : TapPan);
+                TapGain *= 0.7f; // Each tap reduce by 3dB
+                TapPan = MIN(TapPan + EUCLID_PAN_STEP, 1.0f);
+            }
+        }
+    }
+}
+
 /**
  * @brief Euclidean Delay
  * 
- * A Multi-tap delay, where the taps are either ON or OFF 
+ * A true-stereo Multi-tap delay, where the taps are either ON or OFF 
  * depending on the current Euclidean sequence, which is
  * calculated as a number of 'Hits' within a given number
  * of Steps.
  * 
- * The gain applied to each successive tap is decreased
- * compared to the inital Gain amount
+ * This works on a whole block, once the input has been written
+ * to PSRAM. The tap plan is only recalculated when the delays,
+ * divisor, fill or rotation changes. Each distinct tap offset is then
+ * fetched as a single burst read of stereo frames, which serves
+ * both the left and right patterns - up to EUCLID_MAX_TAPS taps.
+ * 
+ * @param input block of interleaved L-R input samples
+ * @param output block of interleaved L-R output samples
+ * @param start WritePointer of the first frame in the block
+ * @param num_frames number of L-R frames
  */
-float Euclidean_Delay(float gain){
-    union uSample ReadSample;
-    float LocalSample = 0.0;
-    float LocalGain = gain;
-    //!!TODO should this be uint32_t LocalDelay_L = (uint32_t)(((float)glbDelay_L / glbRatio)/(float)EuclideanSteps[glbDivisor]-1.0);
-    //!! or even +1??
-    uint32_t LocalDelay_L = (uint32_t)(((float)glbDelay_L /(float)EuclideanSteps[glbDivisor])/ glbRatio);
-    TimeNow = time_us_32();
-    if(TimeNow > PrevTime + 500000){
-        PrevTime = TimeNow;
-        printf("glbDelay_L: %d, glbRatio: %f, Local Delay: %d, Per Step: %d\n",glbDelay_L,glbRatio,LocalDelay_L,LocalDelay_L/EuclideanSteps[glbDivisor]);
-    } 
-
-    for (int thisStep = 0; thisStep < EuclideanSteps[glbDivisor];thisStep++){
-        //check whether this step is a 'hit'
-        if(EuclideanHits[thisStep]== 1){
-            uint32_t LocalReadPtr_L = ((WritePointer + BUF_LEN) - (LocalDelay_L * thisStep)) % BUF_LEN;
-            ReadSample.iSample = psram_read32(&psram_spi, LocalReadPtr_L << 3);
-            LocalSample += ReadSample.fSample * LocalGain;
-            LocalGain *= 0.7f; // Each tap reduce by 6dB 
+void Euclidean_Delay(const float *input, float *output, uint32_t start, uint32_t num_frames){
+    static euclid_plan plan = {.divisor = -1};
+    static union uSample TapFrames[TAP_MAXBLOCK * 2];
+    static float Wet[TAP_MAXBLOCK * 2];
+    if ((plan.delay_L != glbDelay_L) || (plan.delay_R != glbDelay_R) || (plan.divisor != BlockParams.divisor)
+            || (plan.fill != BlockParams.euclid_fill) || (plan.rotation != BlockParams.euclid_rotation)){
+        Euclidean_Plan(&plan, glbDelay_L, glbDelay_R, BlockParams.divisor, BlockParams.euclid_fill, BlockParams.euclid_rotation);
+    }
+    while (num_frames > 0){
+        uint32_t len = MIN(num_frames, TAP_MAXBLOCK);
+        for (uint32_t k = 0; k < len * 2; k++) Wet[k] = 0.0f;
+        for (int r = 0; r < plan.numreads; r++){
+            const euclid_tap *tap = &plan.read[r];
+            float ll = tap->ll, lr = tap->lr;
+            float rl = tap->rl, rr = tap->rr;
+            psram_frames_read((start - tap->offset) & BUF_LEN, TapFrames, len);
+            for (uint32_t k = 0; k < len; k++){
+                float TapL = TapFrames[k * 2].fSample;
+                float TapR = TapFrames[(k * 2) + 1].fSample;
+                Wet[k * 2] += (TapL * ll) + (TapR * rl);
+                Wet[(k * 2) + 1] += (TapL * lr) + (TapR * rr);
+            }
+        }
+        // the taps are scaled by the ramped feedback level as they are mixed
+        for (uint32_t k = 0; k < len; k++){
+            output[k * 2] = WetDry(input[k * 2], Wet[k * 2] * FeedbackRamp.value);
+            output[(k * 2) + 1] = WetDry(input[(k * 2) + 1], Wet[(k * 2) + 1] * FeedbackRamp.value);
+            step_ramps();
         }
-      }
-  return LocalSample;    
+        input += len * 2;
+        output += len * 2;
+        start = (start + len) & BUF_LEN;
+        num_frames -= len;
+    }
 }
 /**
  * @brief Single Delay
@@ -183,143 +452,6 @@ float processAllPassFilter(AllPassFilter *filter, float input) {
     return output;
 }
 
-
-/**
- * C Equivalent of the Arduino bitRead() function
- */
-int bitRead(unsigned int value, unsigned int bit) {
-    return (value >> bit) & 1;
-}
-
-/**
- * @brief find the binary length of a number
- */
-int findlength(unsigned int bnry){
-    bool lengthfound = false;
-    int length=1; // no number can have a length of zero - single 0 has a length of one, but no 1s for the sytem to count
-    for (int q=32;q>=0;q--){
-      int r=bitRead(bnry,q);
-      if(r==1 && lengthfound == false){
-        length=q+1;
-        lengthfound = true;
-      }
-    }
-    return length;
-  }
-
-/**
- * @brief concatenate two binary numbers
- */
-unsigned int ConcatBin(unsigned int bina, unsigned int binb){
-    int binb_len=findlength(binb);
-    unsigned int sum=(bina<<binb_len);
-    sum = sum | binb;
-    return sum;
-  }
-
-
-/**
- * @brief calculate Euclidean fill, given a number of steps and a fill number
- * 
- * This uses the Bjorklund algorithm to calculate a pulse pattern given a number
- * of steps and a fill value. The fill Value needs to be less than or equal to the 
- * number of steps
- * 
- * This returns a 16-Bit unsigned Int binary pattern. Our maximum number of steps
- * is 12, so 16-Bits will hold that quite adequately. The idea is that we pre-calculate
- * all possible Step/Fill combinations.
- * 
- * This is a variation of Tom Whitwell's Euclidean Sequencer Arduino code 
- * 
- * @param n Total number of steps
- * @param k Number of 'Hits' to be evenly distibuted across the steps
- */
-unsigned int bjorklund(int n, int k){
-    int pauses = n-k;
-    int pulses = k;
-    int per_pulse = pauses/k;
-    int remainder = pauses%pulses;  
-    unsigned int workbeat[n];
-    unsigned int outbeat;
-    unsigned int working;
-    int workbeat_count=n;
-    int a; 
-    int b; 
-    int trim_count;
-    for (a=0;a<n;a++){ // Populate workbeat with unsorted pulses and pauses 
-      if (a<pulses){
-        workbeat[a] = 1;
-      }
-      else {
-        workbeat [a] = 0;
-      }
-    }
-  
-    if (per_pulse>0 && remainder <2){ // Handle easy cases where there is no or only one remainer  
-      for (a=0;a<pulses;a++){
-        for (b=workbeat_count-1; b>workbeat_count-per_pulse-1;b--){
-          workbeat[a]  = ConcatBin(workbeat[a], workbeat[b]);
-        }
-        workbeat_count = workbeat_count-per_pulse;
-      }
-  
-      outbeat = 0; // Concatenate workbeat into outbeat - according to workbeat_count 
-      for (a=0;a < workbeat_count;a++){
-        outbeat = ConcatBin(outbeat,workbeat[a]);
-      }
-      return outbeat;
-    }
-  
-    else { 
-      int groupa = pulses;
-      int groupb = pauses; 
-      int iteration=0;
-      if (groupb<=1){
-      }
-      while(groupb>1){ //main recursive loop
-        if (groupa>groupb){ // more Group A than Group B
-          int a_remainder = groupa-groupb; // what will be left of groupa once groupB is interleaved 
-          trim_count = 0;
-          for (a=0; a<groupa-a_remainder;a++){ //count through the matching sets of A, ignoring remaindered
-            workbeat[a]  = ConcatBin (workbeat[a], workbeat[workbeat_count-1-a]);
-            trim_count++;
-          }
-          workbeat_count = workbeat_count-trim_count;
-          groupa=groupb;
-          groupb=a_remainder;
-        }
-        else if (groupb>groupa){ // More Group B than Group A
-          int b_remainder = groupb-groupa; // what will be left of group once group A is interleaved 
-          trim_count=0;
-          for (a = workbeat_count-1;a>=groupa+b_remainder;a--){ //count from right back through the Bs
-            workbeat[workbeat_count-a-1] = ConcatBin (workbeat[workbeat_count-a-1], workbeat[a]);
-            trim_count++;
-          }
-          workbeat_count = workbeat_count-trim_count;
-          groupb=b_remainder;
-        }
-        else if (groupa == groupb){ // groupa = groupb 
-          trim_count=0;
-          for (a=0;a<groupa;a++){
-            workbeat[a] = ConcatBin (workbeat[a],workbeat[workbeat_count-1-a]);
-            trim_count++;
-          }
-          workbeat_count = workbeat_count-trim_count;
-          groupb=0;
-        }
-        else {
-          //printf("ERROR");
-        }
-        iteration++;
-      }
-    outbeat = 0; // Concatenate workbeat into outbeat - according to workbeat_count 
-      for (a=0;a < workbeat_count;a++){
-        outbeat = ConcatBin(outbeat,workbeat[a]);
-      }
-      return outbeat;
-    }
-  }
-
 /**
  * @brief Single-tap delay
  * 
@@ -335,13 +467,13 @@ unsigned int bjorklund(int n, int k){
 float single_tap(union uSample InSample, float gain, bool IsLeft){
     union uSample ReadSample;
     if (IsLeft == true){
-        ReadSample.iSample = psram_read32(&psram_spi, ReadPointer_L << 3);
+        PROFILE(PROF_PSRAM, ReadSample.iSample = psram_read32(&psram_spi, ReadPointer_L << 3));
         InSample.fSample += ReadSample.fSample * gain;
-        psram_write32(&psram_spi, WritePointer<<3,InSample.iSample);
+        PROFILE(PROF_PSRAM, psram_write32(&psram_spi, WritePointer<<3,InSample.iSample));
     } else {
-        ReadSample.iSample = psram_read32(&psram_spi, (ReadPointer_R << 3)+4);
+        PROFILE(PROF_PSRAM, ReadSample.iSample = psram_read32(&psram_spi, (ReadPointer_R << 3)+4));
         InSample.fSample += ReadSample.fSample * gain;
-        psram_write32(&psram_spi, (WritePointer<<3)+4,InSample.iSample);
+        PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer<<3)+4,InSample.iSample));
     }
     return ReadSample.fSample;
 }
@@ -360,14 +492,14 @@ float Ping_Pong(union uSample InSample, float gain, bool IsLeft){
         // Left channel is delayed by half the glbDelay period again
         uint32_t localReadPtr = ReadPointer_L;
         localReadPtr = (ReadPointer_L + (glbDelay_L >> 1)) & BUF_LEN;
-        ReadSample.iSample = psram_read32(&psram_spi, localReadPtr << 3);
+        PROFILE(PROF_PSRAM, ReadSample.iSample = psram_read32(&psram_spi, localReadPtr << 3));
         InSample.fSample += ReadSample.fSample * gain;
-        psram_write32(&psram_spi, WritePointer << 3,InSample.iSample);
+        PROFILE(PROF_PSRAM, psram_write32(&psram_spi, WritePointer << 3,InSample.iSample));
     } else {
         // Right Channel
-        ReadSample.iSample = psram_read32(&psram_spi, (ReadPointer_R << 3)+4);
+        PROFILE(PROF_PSRAM, ReadSample.iSample = psram_read32(&psram_spi, (ReadPointer_R << 3)+4));
         InSample.fSample += ReadSample.fSample * gain;
-        psram_write32(&psram_spi, (WritePointer << 3)+4,InSample.iSample);
+        PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer << 3)+4,InSample.iSample));
     }
     return ReadSample.fSample;
 }
@@ -67,6 +67,9 @@ float glbAPPO_R3 = 0.0f;            // AllPass filter 1 previous output (Right)
 float glbWet = 0;                   // wet/dry multipliers                   
 float glbDry = 1;                   // Between 0 and 1
 float glbFeedback = 0.1;            // Global feedback level (between 0 and 1)
+param_ramp WetRamp = {0, 0, 0, 0};  // glbWet, ramped across each audio block
+param_ramp DryRamp = {1, 0, 1, 1};  // glbDry, ramped across each audio block
+param_ramp FeedbackRamp = {0.1, 0, 0.1, 0.1}; // glbFeedback, ramped across each audio block
 float glbRatio = 1.00;              // Global Clock Multiplication / Division ratio
 int glbDivisor;                     // Global value for the mul/div switch (0 to 15)
 int glbAlgorithm;                   // Global value for Algorithm switch used by other functions
@@ -83,13 +86,17 @@ uint32_t glbDelay_R;                // The actual current Delay (in Samples) Rig
 uint32_t targetDelay_L;             // The target Delay (in samples) - glbDelay will ramp towards this value
 uint32_t targetDelay_R;             // The target Delay (in samples) - glbDelay will ramp towards this value
 int32_t PreviousClockPeriod = 0;    //
+uint32_t FrameCyclesQ8;             // System clock cycles per stereo frame (Q8) at the attained I2S sample rate
 uint32_t glbIncrement = 1;          // How many samples the delay is increased or decreased by via the rotary encoder
 int glbEuclideanFill;               // How many steps are ASctive within the step length
-int spinlock_num_glbDelay;          // used to store the number of the spinlock
-spin_lock_t *spinlock_glbDelay;     // Used to lock access to glbDelay
 ty_gverb * parrot_gverb;
 fv_Context parrot_freeverb;
 pv_Context parrot_pverb;
+reverb_coeffs ReverbCoeffs[2];      // Double buffer of reverb coefficients, written by core1
+_Atomic int ReverbCoeffsPending = -1;  // Index of the set waiting to be applied by core0, -1 = none
+volatile parrot_params SharedParams = {.dry = 1, .feedback = 0.1, .euclid_fill = 1}; // Latest parameters, published by core1
+_Atomic uint32_t SharedParamsSeq = 0;  // SharedParams seqlock - odd while core1 is writing
+parrot_params BlockParams = {.dry = 1, .feedback = 0.1, .euclid_fill = 1};  // core0's copy for the current audio block
 
 /**
  * @brief An array of multipliers, which are applied to the master internal
@@ -101,8 +108,13 @@ pv_Context parrot_pverb;
  * 1/12 1/9 1/8 1/6 1/4 1/3 1/2 1* 2* 3* 4* 6* 8* 9* 12*
  */
 float divisors[] = {1.0,2.0,3.0,4.0,6.0,8.0,9.0,12.0,1.0,0.5,0.333333,0.25,0.166666,0.125,0.111111,0.083333};
+/**
+ * @brief The same ratios as exact fractions (DivisorNum / DivisorDen), so that
+ * the sync'd delay can be worked out in whole samples without rounding error
+ */
+const uint8_t DivisorNum[] = {1,2,3,4,6,8,9,12,1,1,1,1,1,1,1,1};
+const uint8_t DivisorDen[] = {1,1,1,1,1,1,1,1,1,2,3,4,6,8,9,12};
 int EuclideanSteps[] = {1,2,3,4,6,8,9,12,1,2,3,4,6,8,9,12};
-int EuclideanHits[12];
 
 psram_spi_inst_t* async_spi_inst;
 psram_spi_inst_t psram_spi;
@@ -113,19 +125,85 @@ static float output_buffer[STEREO_BUFFER_SIZE * 2];
 float *inbuffptr = &input_buffer[0];
 float *outbuffptr = &output_buffer[0];
 static float freeverb_buffer[2];
-static float pverb_buffer[2];
-
-// Multi-tap delay element
-typedef struct tap_element{
-    uint32_t delay;
-    float  feedback;
-}tap_element;
+static float gverb_in[AUDIO_BUFFER_FRAMES];     // gverb works on a whole block of the left input...
+static float gverb_outl[AUDIO_BUFFER_FRAMES];   // ...and produces a block of stereo output
+static float gverb_outr[AUDIO_BUFFER_FRAMES];
 
 int get_sign(int32_t value)
 {
     return (value & 0x80000000) ? -1 : (int)(value != 0);
 }
 
+/**
+ * @brief apply any new set of reverb coefficients from core1
+ * 
+ * Called at the start of each audio block, so the coefficients
+ * only ever change between blocks
+ */
+static void applyReverbCoeffs(void) {
+    int idx = atomic_exchange(&ReverbCoeffsPending, -1);
+    if (idx < 0) return;
+    const reverb_coeffs *coeffs = &ReverbCoeffs[idx];
+    if (coeffs->changed & REVERB_ROOM) {
+        gverb_apply_revtime(parrot_gverb, coeffs->revtime, coeffs->gverb_alphalog2, coeffs->gverb_fdngains);
+        fv_set_roomsize(&parrot_freeverb, coeffs->roomsize);
+        pv_set_roomsize(&parrot_pverb, coeffs->roomsize);
+    }
+    if (coeffs->changed & REVERB_WETDRY) {
+        fv_set_dry(&parrot_freeverb, coeffs->dry);
+        fv_set_wet(&parrot_freeverb, coeffs->wet);
+        pv_set_dry(&parrot_pverb, coeffs->dry);
+        pv_set_wet(&parrot_pverb, coeffs->wet);
+    }
+}
+
+/**
+ * @brief take a copy of the latest parameters from core1
+ * 
+ * Called once at the start of each audio block. If core1 is part
+ * way through publishing, or publishes while we copy, this block
+ * just keeps the previous snapshot - the audio path never spins.
+ * Any delay jumps requested by core1 are applied here too.
+ */
+static void readParams(void) {
+    static uint32_t LastSeq = 0;
+    uint32_t seq = atomic_load_explicit(&SharedParamsSeq, memory_order_acquire);
+    if ((seq & 1) || (seq == LastSeq)) return;
+    parrot_params next = SharedParams;
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&SharedParamsSeq, memory_order_relaxed) != seq) return;
+    LastSeq = seq;
+    if (next.jump_L != BlockParams.jump_L) glbDelay_L = next.targetDelay_L;
+    if (next.jump_R != BlockParams.jump_R) glbDelay_R = next.targetDelay_R;
+    BlockParams = next;
+}
+
+/**
+ * @brief start a parameter ramp for the next audio block
+ * 
+ * The ramp starts exactly where the last block's ramp finished,
+ * so rounding in the per-frame increments never accumulates
+ * 
+ * @param ramp parameter ramp
+ * @param target value to reach by the end of the block
+ * @param frame_scale 1 / number of frames in the block
+ */
+static void beginRamp(param_ramp *ramp, float target, float frame_scale) {
+    ramp->start = ramp->target;
+    ramp->value = ramp->start;
+    ramp->target = target;
+    ramp->step = (target - ramp->start) * frame_scale;
+}
+/**
+ * @brief wind the ramps back to the start of the block, for block
+ * kernels that run after the per-sample loop has stepped them
+ */
+static void rewindRamps(void) {
+    WetRamp.value = WetRamp.start;
+    DryRamp.value = DryRamp.start;
+    FeedbackRamp.value = FeedbackRamp.start;
+}
+
 /**
  * @brief process a buffer of Audio data
  * 
@@ -138,8 +216,18 @@ int get_sign(int32_t value)
  * @param num_frames number of L-R samples
  */
 static void process_audio(const int32_t* input, int32_t* output, size_t num_frames) {
+    profile_block_start();
+    PROFILE_BEGIN(BlockStart);
     size_t tmpIndex;
-    int tmpAlgorithm = glbAlgorithm;    //saving it locally prevents it being changed during buffer processing 
+    readParams();
+    int tmpAlgorithm = BlockParams.algorithm;
+    applyReverbCoeffs();
+    // Wet, Dry & Feedback ramp from their last values to the current
+    // ones across the block, instead of stepping whenever core1 writes
+    float frame_scale = 1.0f / (float)num_frames;
+    beginRamp(&WetRamp, BlockParams.wet, frame_scale);
+    beginRamp(&DryRamp, BlockParams.dry, frame_scale);
+    beginRamp(&FeedbackRamp, BlockParams.feedback, frame_scale);
     /*
     * Convert to Floats and normalise to -1.0 - +1.0f
     */
@@ -153,14 +241,14 @@ static void process_audio(const int32_t* input, int32_t* output, size_t num_fram
     /*
     *   Left Channel Sample
     */
+    PROFILE_BEGIN(LoopStart);
     for (size_t i = 0; i < num_frames * 2; i++) {
-        float yl,yr,xl,xr;
         // If the delay changes, gradually ramping the actual delay 
         // towards the target delay helps to reduce glitches. 
-        if (glbDelay_L < targetDelay_L){
+        if (glbDelay_L < BlockParams.targetDelay_L){
             glbDelay_L++;
         }
-        if (glbDelay_L > targetDelay_L){
+        if (glbDelay_L > BlockParams.targetDelay_L){
             glbDelay_L--;
         }
         ReadPointer_L = ((WritePointer + BUF_LEN) - glbDelay_L) % BUF_LEN;
@@ -172,49 +260,47 @@ static void process_audio(const int32_t* input, int32_t* output, size_t num_fram
         DrySample.fSample = ThisSample.fSample;
         switch(tmpAlgorithm){
             case 0:
-                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, glbFeedback, true));
+                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, FeedbackRamp.value, true));
                 output_buffer[i] = ThisSample.fSample;
                 break;
             case 1:
-                ThisSample.fSample = WetDry(DrySample.fSample,Ping_Pong(ThisSample, glbFeedback, true));
+                ThisSample.fSample = WetDry(DrySample.fSample,Ping_Pong(ThisSample, FeedbackRamp.value, true));
                 output_buffer[i] = ThisSample.fSample;
                 break;
             case 2:
                 // BUT delay change only affects Left Channel
-                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, glbFeedback, true));
+                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, FeedbackRamp.value, true));
                 output_buffer[i] = ThisSample.fSample;
                 break;
             case 3:
                 // BUT delay change only affects Right Channel
-                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, glbFeedback, true));
+                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, FeedbackRamp.value, true));
                 output_buffer[i] = ThisSample.fSample;
                 break;
             case 4:
-                // Pverb = just set left-sample
-                pverb_buffer[0] = input_buffer[i];
-                tmpIndex = i;                
+                // Pverb = just pass the dry sample through for now,
+                // the whole buffer is processed at the end of the block
+                PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer << 3),ThisSample.iSample));
+                output_buffer[i] = input_buffer[i];
                 break;
             case 5:
                 // F = Freeverb = just set left-sample
-                psram_write32(&psram_spi, (WritePointer << 3),ThisSample.iSample);  //just to make sure the buffer is OK
+                PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer << 3),ThisSample.iSample));  //just to make sure the buffer is OK
                 freeverb_buffer[0] = input_buffer[i];
                 tmpIndex = i;
                 break;
             case 6:
-                // G = Gverb!!
-                psram_write32(&psram_spi, (WritePointer << 3),ThisSample.iSample);
-                xl = input_buffer[i];
-                gverb_do(parrot_gverb,xl,&yl,&yr);
-                ThisSample.fSample = WetDry(xl,yl);
-                output_buffer[i] = ThisSample.fSample;
+                // G = Gverb!! - just collect the left input here,
+                // the whole block is processed at the end
+                PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer << 3),ThisSample.iSample));
+                gverb_in[i >> 1] = input_buffer[i];
                 break;
             case 7:
-                xl = input_buffer[i];
-                psram_write32(&psram_spi, (WritePointer << 3),ThisSample.iSample);
-                tmpIndex = i;
+                // Euclidean delay - processed on the whole block at the end
+                PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer << 3),ThisSample.iSample));
                 break;
             default:
-                ThisSample.fSample = single_tap(ThisSample, glbFeedback, true);
+                ThisSample.fSample = single_tap(ThisSample, FeedbackRamp.value, true);
                 output_buffer[i] = ThisSample.fSample;
                 break;
         }
@@ -223,10 +309,10 @@ static void process_audio(const int32_t* input, int32_t* output, size_t num_fram
         *   Right Channel Sample
         */
         i++;
-        if (glbDelay_R < targetDelay_R){
+        if (glbDelay_R < BlockParams.targetDelay_R){
             glbDelay_R++;
         }
-        if (glbDelay_R > targetDelay_R){
+        if (glbDelay_R > BlockParams.targetDelay_R){
             glbDelay_R--;
         }
         ReadPointer_R = ((WritePointer + BUF_LEN) - glbDelay_R) % BUF_LEN;
@@ -234,62 +320,83 @@ static void process_audio(const int32_t* input, int32_t* output, size_t num_fram
         DrySample.fSample = ThisSample.fSample;
         switch(tmpAlgorithm){
             case 0:
-                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, glbFeedback, false));
+                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, FeedbackRamp.value, false));
                 output_buffer[i] = ThisSample.fSample;
                 break;
             case 1:
-                ThisSample.fSample = WetDry(DrySample.fSample,Ping_Pong(ThisSample, glbFeedback, false));
+                ThisSample.fSample = WetDry(DrySample.fSample,Ping_Pong(ThisSample, FeedbackRamp.value, false));
                 output_buffer[i] = ThisSample.fSample;
                 break;
             case 2:
                 // BUT delay change only affects Left Channel
-                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, glbFeedback, false));
+                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, FeedbackRamp.value, false));
                 output_buffer[i] = ThisSample.fSample;
                 break;
             case 3:
                 // BUT delay change only affects Right Channel
-                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, glbFeedback, false));
+                ThisSample.fSample = WetDry(DrySample.fSample,single_tap(ThisSample, FeedbackRamp.value, false));
                 output_buffer[i] = ThisSample.fSample;
                 break;
             case 4:
                 // Pverb!!
-                psram_write32(&psram_spi, (WritePointer << 3) + 4,ThisSample.iSample);
-                pverb_buffer[1] = input_buffer[i];
-                pv_process(&parrot_pverb, &pverb_buffer[0], 1);
-                output_buffer[tmpIndex] = pverb_buffer[0];
-                output_buffer[i] = pverb_buffer[1];
+                PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer << 3) + 4,ThisSample.iSample));
+                output_buffer[i] = input_buffer[i];
                 break;
             case 5:
                 // F = Freeverb!!
-                psram_write32(&psram_spi, (WritePointer << 3) + 4,ThisSample.iSample);
+                PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer << 3) + 4,ThisSample.iSample));
                 freeverb_buffer[1] = input_buffer[i];
-                fv_process(&parrot_freeverb, &freeverb_buffer[0], 1);
+                PROFILE(PROF_FREEVERB, fv_process(&parrot_freeverb, &freeverb_buffer[0], 1));
                 output_buffer[tmpIndex] = freeverb_buffer[0];
                 output_buffer[i] = freeverb_buffer[1];
                 break;
             case 6:
                 // G = Gverb!
-                // yr was calculated in Left Channel, so is just output here
-                psram_write32(&psram_spi, (WritePointer << 3) + 4,ThisSample.iSample);
-                ThisSample.fSample = WetDry(xl,yr);
-                output_buffer[i] = ThisSample.fSample;
+                PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer << 3) + 4,ThisSample.iSample));
                 break;
             case 7:
-                xr = input_buffer[i];
-                psram_write32(&psram_spi, (WritePointer << 3) + 4,ThisSample.iSample);
-                ThisSample.fSample = WetDry(DrySample.fSample,Euclidean_Delay(glbFeedback));
-                output_buffer[tmpIndex] = ThisSample.fSample;
-                output_buffer[i] = ThisSample.fSample;
+                PROFILE(PROF_PSRAM, psram_write32(&psram_spi, (WritePointer << 3) + 4,ThisSample.iSample));
                 break;
             default:
-                ThisSample.fSample = single_tap(ThisSample, glbFeedback, false);
+                ThisSample.fSample = single_tap(ThisSample, FeedbackRamp.value, false);
                 output_buffer[i] = ThisSample.fSample;
                 break;
             }
         //ReadPointer_R = ReadPointer_R++ & BUF_LEN;
+        step_ramps();
         WritePointer++;
         WritePointer &= BUF_LEN;
     }
+    PROFILE_END(PROF_SAMPLE_LOOP, LoopStart);
+    /*
+    * The block kernels below walk the ramps again from the start
+    */
+    rewindRamps();
+    /*
+    * Pverb works on the whole block at once, so that it can
+    * stream its delay lines to and from PSRAM in bursts
+    */
+    if (tmpAlgorithm == 4) {
+        PROFILE(PROF_PVERB, pv_process(&parrot_pverb, output_buffer, num_frames * 2));
+    }
+    /*
+    * The Euclidean delay taps are read once the whole block has
+    * been written to PSRAM
+    */
+    if (tmpAlgorithm == 7) {
+        PROFILE(PROF_EUCLIDEAN, Euclidean_Delay(input_buffer, output_buffer, (WritePointer - num_frames) & BUF_LEN, num_frames));
+    }
+    /*
+    * Likewise gverb, which runs each stage over the block
+    */
+    if (tmpAlgorithm == 6) {
+        PROFILE(PROF_GVERB, gverb_do_block(parrot_gverb, gverb_in, gverb_outl, gverb_outr, num_frames));
+        for (size_t i = 0; i < num_frames; i++){
+            output_buffer[i * 2] = WetDry(gverb_in[i], gverb_outl[i]);
+            output_buffer[(i * 2) + 1] = WetDry(gverb_in[i], gverb_outr[i]);
+            step_ramps();
+        }
+    }
     /*
     * Convert back from floats to signed 32-Bit Ints
     */
@@ -298,6 +405,8 @@ static void process_audio(const int32_t* input, int32_t* output, size_t num_fram
         // left-justified in 32-bit integer 
         output[i] = (int32_t)(output_buffer[i] * 0x07FFFFF) << 8;
     }
+    PROFILE_END(PROF_BLOCK, BlockStart);
+    profile_block(tmpAlgorithm);
 }
 /**
  * @brief I2S Audio input DMA handler
@@ -350,8 +459,8 @@ void checkReset(){
                 psram_write32(&psram_spi, ResetCounter << 3,0x0);
                 psram_write32(&psram_spi, (ResetCounter << 3) + 4,0x0);
             }
-            glbDelay_L = targetDelay_L; //be done with it!
-            glbDelay_R = targetDelay_R; //be done with it!
+            glbDelay_L = BlockParams.targetDelay_L; //be done with it!
+            glbDelay_R = BlockParams.targetDelay_R; //be done with it!
             // Flush / Mute Gverb & Freeverb
             gverb_flush(parrot_gverb);
             fv_mute(&parrot_freeverb);
@@ -375,6 +484,8 @@ int main(){
     set_sys_clock_khz(280000, true);
     // Serial port initialisation (Using USB for stdio)
     stdio_init_all();
+    // Cycle counter used to time the audio processing on this core
+    cycle_counter_init();
     // Pre-start delay for testing
     for(int i = 1;i <= 20; i++){
       printf("Waiting to start %d\n",20-i);
@@ -403,9 +514,6 @@ int main(){
      * @brief Initialise the PSRAM SPI interface, which uses pio0
      */
     psram_spi = psram_spi_init(pio0, -1);
-    // Claim and initialize a spinlock
-    spinlock_num_glbDelay = spin_lock_claim_unused(true) ;
-    spinlock_glbDelay = spin_lock_init(spinlock_num_glbDelay) ;
     // Zero out the Audio Buffer
     for(WritePointer = 0;WritePointer < BUF_LEN; WritePointer++){
         psram_write32(&psram_spi, WritePointer << 3,0x0);
@@ -440,10 +548,18 @@ int main(){
      * @param float earlylevel,
 	 * @param float taillevel
      */
-    parrot_gverb = gverb_new(48000.f, 41.f, 40.f, 7.0f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f);
+    parrot_gverb = gverb_new(48000.f, GVERB_MAXROOMSIZE, GVERB_ROOMSIZE, 7.0f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f);
 
     size_t space1 = get_free_ram();
     printf("RAM used by gverb: %d\n",initial_space - space1);
+    printf("gverb buffers (%s): FDN %d x %d, taps %d samples\n",GVERB_PSRAM ? "PSRAM" : "SRAM",
+        FDNORDER,parrot_gverb->fdnsize,parrot_gverb->tapdelay.size);
+#ifdef PARROT_BENCHMARK
+    gverb_benchmark(parrot_gverb, 48000);
+#ifdef PARROT_MULTITAP
+    multitap_benchmark();
+#endif
+#endif
     /**
      * @brief instantiate a freeverb instance
      * 
@@ -457,13 +573,16 @@ int main(){
      */
     pv_init(&parrot_pverb);
     size_t space3 = get_free_ram();
-    printf("RAM used by pverb: %d\n",space2 - space3);
+    printf("RAM used by pverb (%s topology): %d\n",PV_TOPOLOGY_NAME,space2 - space3);
     printf("Free RAM remaining: %d\n",space3);
     
     /**
      * @brief Start the Audio I2S interface, which uses pio1
      */
     i2s_program_start_synched(pio1, &i2s_config_default, dma_i2s_in_handler, &i2s);
+    FrameCyclesQ8 = i2s.clocks.frame_cycles_q8;
+    printf("I2S sample rate attained: %f\n",i2s.clocks.fs_attained);
+    profile_init((uint32_t)(((uint64_t)AUDIO_BUFFER_FRAMES * FrameCyclesQ8) >> 8));
     // Un-mute the output
     gpio_put(XSMT_PIN,1);
 
@@ -475,6 +594,8 @@ int main(){
     while(1){
         // check the panic button (encoder switch)
         checkReset();
+        // USB console profiler commands (PARROT_PROFILE only)
+        profile_poll();
         tight_loop_contents();
     }
 
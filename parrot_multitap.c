@@ -0,0 +1,224 @@
+/******************************************************************************
+
+The Camberwell Parrot
+
+Copyright © 2024 Richard R. Goodwin / Audio Morphology Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+******************************************************************************/
+/**
+ * @file parrot_multitap.c
+ * 
+ * Generic multi-tap delay, working on whole blocks in the main
+ * PSRAM delay buffer. No algorithm uses it yet, so it is only built
+ * when PARROT_MULTITAP is defined in CMakeLists.txt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "parrot.h"
+#include "psram_spi.h"
+#include <arm_math.h>
+
+#ifdef PARROT_MULTITAP
+
+// Working buffers. These are static rather than on the stack, as
+// multitap_process is called from the I2S DMA interrupt
+static union uSample SpanFrames[MULTITAP_SPAN_FRAMES * 2];
+static union uSample FeedFrames[TAP_MAXBLOCK * 2];
+static float Wet[TAP_MAXBLOCK * 2];
+
+/**
+ * @brief set up a multi-tap delay from a list of taps
+ * 
+ * The taps are sorted by delay, then merged into spans: a tap whose
+ * read overlaps or touches the read of the tap before it shares that
+ * read, as long as the span stays within MULTITAP_SPAN_FRAMES. Taps
+ * shorter than TAP_MAXBLOCK are never merged with longer ones, as
+ * they have to be read after the block has been written.
+ * 
+ * @param mt multi-tap delay
+ * @param taps list of taps
+ * @param numtaps number of taps (up to MULTITAP_MAX_TAPS)
+ */
+void multitap_init(multitap *mt, const tap_element *taps, int numtaps){
+    if (numtaps > MULTITAP_MAX_TAPS) numtaps = MULTITAP_MAX_TAPS;
+    if (numtaps < 0) numtaps = 0;
+    mt->numtaps = numtaps;
+    mt->numspans = 0;
+    mt->transactions = 0;
+    // insertion sort by delay - there are only ever a handful of taps
+    for (int t = 0; t < numtaps; t++){
+        tap_element tap = taps[t];
+        // keep the longest read clear of the block being written
+        if (tap.delay > BUF_LEN - MULTITAP_SPAN_FRAMES) tap.delay = BUF_LEN - MULTITAP_SPAN_FRAMES;
+        int i = t;
+        while ((i > 0) && (mt->taps[i - 1].delay > tap.delay)){
+            mt->taps[i] = mt->taps[i - 1];
+            i--;
+        }
+        mt->taps[i] = tap;
+    }
+    // equal power pan, the same as the Euclidean delay taps
+    for (int t = 0; t < numtaps; t++){
+        float angle = (MAX(-1.0f, MIN(mt->taps[t].pan, 1.0f)) + 1.0f) * PI * 0.25f;
+        mt->gain_l[t] = mt->taps[t].gain * cosf(angle);
+        mt->gain_r[t] = mt->taps[t].gain * sinf(angle);
+    }
+    for (int t = 0; t < numtaps; t++){
+        uint32_t delay = mt->taps[t].delay;
+        bool late = (delay < TAP_MAXBLOCK);
+        if (mt->numspans > 0){
+            multitap_span *span = &mt->span[mt->numspans - 1];
+            uint32_t frames = delay - mt->taps[span->first].delay;
+            if ((span->late == late) && (delay - mt->taps[t - 1].delay <= TAP_MAXBLOCK)
+                    && (frames + TAP_MAXBLOCK <= MULTITAP_SPAN_FRAMES)){
+                span->offset = delay;
+                span->frames = frames;
+                span->count++;
+                continue;
+            }
+        }
+        multitap_span *span = &mt->span[mt->numspans++];
+        span->offset = delay;
+        span->frames = 0;
+        span->first = t;
+        span->count = 1;
+        span->late = late;
+    }
+}
+
+/**
+ * @brief read one span and mix its taps into the wet output
+ * 
+ * @param mt multi-tap delay
+ * @param span span to read
+ * @param start WritePointer of the first frame in the block
+ * @param len number of frames in the block
+ * @param feed whether to add the taps' feedback to the block being written
+ */
+static void multitap_span_process(multitap *mt, const multitap_span *span, uint32_t start, uint32_t len, bool feed){
+    mt->transactions += psram_frames_read((start - span->offset) & BUF_LEN, SpanFrames, span->frames + len);
+    for (int t = span->first; t < span->first + span->count; t++){
+        const tap_element *tap = &mt->taps[t];
+        const union uSample *src = &SpanFrames[(span->offset - tap->delay) * 2];
+        float gl = mt->gain_l[t];
+        float gr = mt->gain_r[t];
+        for (uint32_t k = 0; k < len; k++){
+            float TapL = src[k * 2].fSample;
+            float TapR = src[(k * 2) + 1].fSample;
+            Wet[k * 2] += TapL * gl;
+            Wet[(k * 2) + 1] += TapR * gr;
+            if (feed){
+                FeedFrames[k * 2].fSample += (TapL * tap->feedback) + (TapR * tap->crossfeed);
+                FeedFrames[(k * 2) + 1].fSample += (TapR * tap->feedback) + (TapL * tap->crossfeed);
+            }
+        }
+    }
+}
+
+/**
+ * @brief run a block through the multi-tap delay
+ * 
+ * The spans of taps at least a block long are read first, and their
+ * feedback added to the input, which is then burst-written to PSRAM.
+ * The spans of any shorter taps are read after that, so that they
+ * pick up the block that has just been written.
+ * 
+ * @param mt multi-tap delay
+ * @param input block of interleaved L-R input samples
+ * @param output block of interleaved L-R output samples
+ * @param start WritePointer of the first frame in the block
+ * @param num_frames number of L-R frames
+ */
+void multitap_process(multitap *mt, const float *input, float *output, uint32_t start, uint32_t num_frames){
+    mt->transactions = 0;
+    while (num_frames > 0){
+        uint32_t len = MIN(num_frames, TAP_MAXBLOCK);
+        for (uint32_t k = 0; k < len * 2; k++){
+            Wet[k] = 0.0f;
+            FeedFrames[k].fSample = input[k];
+        }
+        for (int s = 0; s < mt->numspans; s++){
+            if (!mt->span[s].late) multitap_span_process(mt, &mt->span[s], start, len, true);
+        }
+        mt->transactions += psram_frames_write(start, FeedFrames, len);
+        for (int s = 0; s < mt->numspans; s++){
+            if (mt->span[s].late) multitap_span_process(mt, &mt->span[s], start, len, false);
+        }
+        for (uint32_t k = 0; k < len; k++){
+            output[k * 2] = WetDry(input[k * 2], Wet[k * 2]);
+            output[(k * 2) + 1] = WetDry(input[(k * 2) + 1], Wet[(k * 2) + 1]);
+            step_ramps();
+        }
+        input += len * 2;
+        output += len * 2;
+        start = (start + len) & BUF_LEN;
+        num_frames -= len;
+    }
+}
+
+/**
+ * @brief time the multi-tap delay on the target
+ * 
+ * For 1 to MULTITAP_MAX_TAPS taps, runs blocks of silence through
+ * the multi-tap delay with the taps spread out (one read per tap) and
+ * then clustered (merged into shared reads), and prints the cycles and
+ * PSRAM SPI transactions per block for each. Silence in means silence
+ * is written, so the delay buffer is left clear. Only built when
+ * PARROT_BENCHMARK is defined in CMakeLists.txt
+ */
+#define MULTITAP_BENCH_BLOCK 48     // frames per block, as delivered by the I2S DMA
+#define MULTITAP_BENCH_BLOCKS 100   // blocks timed for each tap count
+void multitap_benchmark(void){
+    static multitap mt;
+    static tap_element taps[MULTITAP_MAX_TAPS];
+    static float in[MULTITAP_BENCH_BLOCK * 2], out[MULTITAP_BENCH_BLOCK * 2];
+    for (int k = 0; k < MULTITAP_BENCH_BLOCK * 2; k++) in[k] = 0.0f;
+    printf("multitap: taps, spread cycles/block, SPI transactions, clustered cycles/block, SPI transactions\n");
+    for (int numtaps = 1; numtaps <= MULTITAP_MAX_TAPS; numtaps++){
+        uint32_t cycles[2], transactions[2];
+        for (int layout = 0; layout < 2; layout++){
+            for (int t = 0; t < numtaps; t++){
+                // spread: 50ms apart, clustered: 40 frames apart
+                taps[t].delay = 4800 + (t * ((layout == 0) ? 2400 : 40));
+                taps[t].gain = 0.5f;
+                taps[t].pan = 0.0f;
+                taps[t].feedback = 0.1f;
+                taps[t].crossfeed = 0.0f;
+            }
+            multitap_init(&mt, taps, numtaps);
+            uint32_t start = 0;
+            uint32_t total = 0;
+            uint32_t elapsed = cycle_count();
+            for (int b = 0; b < MULTITAP_BENCH_BLOCKS; b++){
+                multitap_process(&mt, in, out, start, MULTITAP_BENCH_BLOCK);
+                total += mt.transactions;
+                start = (start + MULTITAP_BENCH_BLOCK) & BUF_LEN;
+            }
+            cycles[layout] = (cycle_count() - elapsed) / MULTITAP_BENCH_BLOCKS;
+            transactions[layout] = total / MULTITAP_BENCH_BLOCKS;
+        }
+        printf("multitap: %2d, %lu, %lu, %lu, %lu\n", numtaps,
+            (unsigned long)cycles[0], (unsigned long)transactions[0],
+            (unsigned long)cycles[1], (unsigned long)transactions[1]);
+    }
+}
+
+#endif
@@ -0,0 +1,180 @@
+/******************************************************************************
+
+The Camberwell Parrot
+
+Copyright © 2024 Richard R. Goodwin / Audio Morphology Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+******************************************************************************/
+/**
+ * @file parrot_profile.c
+ *
+ * DWT cycle profiler for the audio path. Only built when PARROT_PROFILE
+ * is defined in CMakeLists.txt
+ *
+ * profile_block_start() clears ProfileAcc as each audio block starts,
+ * the PROFILE() sites add their cycles into it as the block runs, and
+ * profile_block() folds the totals into the stats for the current
+ * algorithm at the end of the block. Send 'p' on the USB console to
+ * print the stats, or 'r' to clear them.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "parrot.h"
+#include "i2s/i2s.h"
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+
+#ifdef PARROT_PROFILE
+
+/**
+ * @brief cycles taken by one region, one value per audio block
+ */
+typedef struct {
+    uint32_t count;                 // blocks in which the region ran
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} profile_stats;
+
+/**
+ * @brief everything recorded for one algorithm
+ */
+typedef struct {
+    profile_stats region[PROF_REGIONS];
+    uint32_t hist[PROFILE_HIST_BINS];   // PROF_BLOCK cycles, in 1/8ths of the budget
+    uint32_t misses;                    // blocks that took longer than the budget
+} profile_algorithm;
+
+static const char *ProfileNames[PROF_REGIONS] = {"block", "sample loop", "freeverb", "pverb", "gverb", "euclidean", "psram"};
+
+uint32_t ProfileAcc[PROF_REGIONS];  // Cycles in each region so far this block
+static profile_algorithm ProfileStats[PROFILE_ALGORITHMS];
+static profile_algorithm ProfileCopy;   // Snapshot taken for printing, outside of the audio IRQ
+static uint32_t ProfileBudget;      // Cycles between audio blocks
+
+/**
+ * @brief clear all of the profiler stats
+ */
+void profile_reset(void){
+    uint32_t ints = save_and_disable_interrupts();
+    memset(ProfileStats, 0, sizeof(ProfileStats));
+    for (int a = 0; a < PROFILE_ALGORITHMS; a++){
+        for (int r = 0; r < PROF_REGIONS; r++) ProfileStats[a].region[r].min = UINT32_MAX;
+    }
+    memset(ProfileAcc, 0, sizeof(ProfileAcc));
+    restore_interrupts(ints);
+}
+
+/**
+ * @brief set up the profiler
+ *
+ * @param budget system clock cycles per audio block, which a block
+ * has to finish within to not miss its deadline
+ */
+void profile_init(uint32_t budget){
+    ProfileBudget = budget;
+    profile_reset();
+}
+
+/**
+ * @brief start timing a new audio block
+ * 
+ * Called at the top of process_audio. The PSRAM sites also count when
+ * they run outside of a block (the boot benchmarks, or the buffer
+ * flushes in the core0 main loop), so whatever has built up since the
+ * last block is thrown away here rather than being added to this one
+ */
+void profile_block_start(void){
+    memset(ProfileAcc, 0, sizeof(ProfileAcc));
+}
+
+/**
+ * @brief fold this block's region totals into the stats
+ *
+ * Called from the I2S DMA interrupt once process_audio has finished.
+ * Regions that didn't run this block are left out, so they don't
+ * drag the minimum down to 0
+ *
+ * @param algorithm the algorithm the block was processed with
+ */
+void profile_block(int algorithm){
+    if ((algorithm < 0) || (algorithm >= PROFILE_ALGORITHMS)) algorithm = 0;
+    profile_algorithm *alg = &ProfileStats[algorithm];
+    for (int r = 0; r < PROF_REGIONS; r++){
+        uint32_t cycles = ProfileAcc[r];
+        if (cycles == 0) continue;
+        profile_stats *st = &alg->region[r];
+        st->count++;
+        st->total += cycles;
+        if (cycles < st->min) st->min = cycles;
+        if (cycles > st->max) st->max = cycles;
+        if (r == PROF_BLOCK){
+            uint32_t bin = (uint32_t)(((uint64_t)cycles * 8) / ProfileBudget);
+            if (bin >= PROFILE_HIST_BINS) bin = PROFILE_HIST_BINS - 1;
+            alg->hist[bin]++;
+            if (cycles > ProfileBudget) alg->misses++;
+        }
+    }
+}
+
+/**
+ * @brief print the stats for every algorithm that has run
+ */
+void profile_dump(void){
+    printf("Audio block budget %lu cycles at %lu MHz (%d frames)\n", (unsigned long)ProfileBudget,
+        (unsigned long)(clock_get_hz(clk_sys) / 1000000), AUDIO_BUFFER_FRAMES);
+    for (int a = 0; a < PROFILE_ALGORITHMS; a++){
+        // take a copy, so that the audio IRQ isn't held off while printing
+        uint32_t ints = save_and_disable_interrupts();
+        ProfileCopy = ProfileStats[a];
+        restore_interrupts(ints);
+        if (ProfileCopy.region[PROF_BLOCK].count == 0) continue;
+        printf("Algorithm %d: %lu blocks, %lu deadline misses\n", a,
+            (unsigned long)ProfileCopy.region[PROF_BLOCK].count, (unsigned long)ProfileCopy.misses);
+        for (int r = 0; r < PROF_REGIONS; r++){
+            profile_stats *st = &ProfileCopy.region[r];
+            if (st->count == 0) continue;
+            printf("  %-12s min %7lu avg %7lu max %7lu cycles (max %3lu%% of budget)\n", ProfileNames[r],
+                (unsigned long)st->min, (unsigned long)(st->total / st->count), (unsigned long)st->max,
+                (unsigned long)(((uint64_t)st->max * 100) / ProfileBudget));
+        }
+        printf("  histogram (1/8 budget per bin):");
+        for (int b = 0; b < PROFILE_HIST_BINS; b++) printf(" %lu", (unsigned long)ProfileCopy.hist[b]);
+        printf("\n");
+    }
+}
+
+/**
+ * @brief check the USB console for a profiler command
+ *
+ * Called from the core0 main loop: 'p' prints the stats, 'r' clears them
+ */
+void profile_poll(void){
+    int c = getchar_timeout_us(0);
+    if (c == 'p') profile_dump();
+    if (c == 'r') {
+        profile_reset();
+        printf("Profiler stats cleared\n");
+    }
+}
+
+#endif
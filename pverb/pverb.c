@@ -47,42 +47,65 @@ static inline float xabs(float n) {
 //  while (n--) { ((char*) buf)[n] = 0; }
 //}
 
+// Working buffers for one burst block. These are static rather than
+// on the stack, as pv_process is called from the I2S DMA interrupt
+static float pv_line[PV_MAXBLOCK];
+static float pv_input[PV_MAXBLOCK];
+static float pv_outl[PV_MAXBLOCK];
+static float pv_outr[PV_MAXBLOCK];
+// PSRAM SPI transactions made so far in the current block
+static uint32_t pv_transactions;
+
 /**
- * @brief run the passed sample through the referenced AllPass filter
+ * @brief run a block of samples through the referenced AllPass filter
+ * 
+ * The whole block of the delay line is burst-read from PSRAM, processed
+ * then burst-written back. This gives the same result as processing
+ * sample by sample, as long as the block is no longer than the line.
+ * 
+ * @param ap AllPass filter
+ * @param buf samples to process, replaced by the output
+ * @param len number of samples in the block
  */
-static inline float allpass_process(pv_Allpass *ap, float input) {
-    // Read delayed sample
-    union uSample ReadSample, WriteSample;
-    uint32_t BufPtr = ap->buf_base + ap->bufidx;
-    ReadSample.iSample = psram_read32(&psram_spi, BufPtr << 3);
-    undenormalize(ReadSample.fSample);
-    union uSample output;
-    output.fSample = -input + ReadSample.fSample;
-    WriteSample.fSample = input + ReadSample.fSample * ap->feedback;
-    psram_write32(&psram_spi, (BufPtr << 3),WriteSample.iSample);
-    if (++ap->bufidx >= ap->bufsize) {
-      ap->bufidx = 0;
-    }
-  return output.fSample;
+static inline void allpass_process(pv_Allpass *ap, float *buf, int len) {
+  pv_transactions += psram_ring_read(ap->buf_base, ap->bufsize, ap->bufidx, pv_line, len);
+  for (int k = 0; k < len; k++) {
+    float bufout = pv_line[k];
+    undenormalize(bufout);
+    float input = buf[k];
+    buf[k] = -input + bufout;
+    pv_line[k] = input + bufout * ap->feedback;
+  }
+  pv_transactions += psram_ring_write(ap->buf_base, ap->bufsize, ap->bufidx, pv_line, len);
+  ap->bufidx += len;
+  if (ap->bufidx >= ap->bufsize) {
+    ap->bufidx -= ap->bufsize;
+  }
 }
 
 /**
- * @brief run the passed sample through the referenced comb filter
+ * @brief run a block of samples through the referenced comb filter
+ * 
+ * @param cmb comb filter
+ * @param input block of input samples
+ * @param output block the comb filter output is added to
+ * @param len number of samples in the block
  */
-static inline float comb_process(pv_Comb *cmb, float input) {
-  union uSample ReadSample, WriteSample;
-  uint32_t BufPtr = cmb->buf_base + cmb->bufidx;
-  ReadSample.iSample = psram_read32(&psram_spi, BufPtr << 3);
-  undenormalize(ReadSample.fSample);
-
-  cmb->filterstore = ReadSample.fSample * cmb->damp2 + cmb->filterstore * cmb->damp1;
-  undenormalize(cmb->filterstore);
-  WriteSample.fSample = input + ReadSample.fSample * cmb->feedback;
-  psram_write32(&psram_spi, BufPtr << 3,WriteSample.iSample);
-  if (++cmb->bufidx >= cmb->bufsize) {
-    cmb->bufidx = 0;
+static inline void comb_process(pv_Comb *cmb, const float *input, float *output, int len) {
+  pv_transactions += psram_ring_read(cmb->buf_base, cmb->bufsize, cmb->bufidx, pv_line, len);
+  for (int k = 0; k < len; k++) {
+    float bufout = pv_line[k];
+    undenormalize(bufout);
+    cmb->filterstore = bufout * cmb->damp2 + cmb->filterstore * cmb->damp1;
+    undenormalize(cmb->filterstore);
+    pv_line[k] = input[k] + bufout * cmb->feedback;
+    output[k] += bufout;
+  }
+  pv_transactions += psram_ring_write(cmb->buf_base, cmb->bufsize, cmb->bufidx, pv_line, len);
+  cmb->bufidx += len;
+  if (cmb->bufidx >= cmb->bufsize) {
+    cmb->bufidx -= cmb->bufsize;
   }
-  return ReadSample.fSample;
 }
 
 /**
@@ -98,26 +121,36 @@ static inline void comb_set_damp(pv_Comb *cmb, float n) {
  */
 void pv_init(pv_Context *ctx) {
   // Set the base address for all of the Buffers in PSRAM
-  uint32_t base_address = 0x80000;  // Half-way up the available RAM
-  uint32_t buffer_length = 0x2000;  // 8,192 samples - Largest delay is 1600 samples, so more than adequate
+  uint32_t base_address = PV_PSRAM_BASE;
+  uint32_t buffer_length = PV_LINE_BYTES;
   for (int i = 0; i < PV_NUMALLPASSES; i++) {
     ctx->allpassl[i].buf_base = base_address;
     base_address += buffer_length;
+#if PV_STEREO
     ctx->allpassr[i].buf_base = base_address;
     base_address += buffer_length;
+#endif
   }
   for (int i = 0; i < PV_NUMCOMBS; i++) {
     ctx->combl[i].buf_base = base_address;
     base_address += buffer_length;
+#if PV_STEREO
     ctx->combr[i].buf_base = base_address;
     base_address += buffer_length;
+#endif
   }
+  ctx->stats.block_cycles = 0;
+  ctx->stats.block_transactions = 0;
+  ctx->stats.block_frames = 0;
+  atomic_store_explicit(&ctx->stats_seq, 0, memory_order_relaxed);
   sleep_ms(500);
   pv_set_samplerate(ctx, PV_INITIALSR);
   pv_mute(ctx);
   for (int i = 0; i < PV_NUMALLPASSES; i++) {
     ctx->allpassl[i].feedback = 0.5;
+#if PV_STEREO
     ctx->allpassr[i].feedback = 0.5;
+#endif
   }
   pv_set_wet(ctx, PV_INITIALWET);
   pv_set_roomsize(ctx, PV_INITIALROOM);
@@ -134,23 +167,28 @@ void pv_init(pv_Context *ctx) {
  */
 void pv_mute(pv_Context *ctx) {
   //printf("pv_mute\n");
-  uint32_t writeptr;
+  for (int i = 0; i < PV_MAXBLOCK; i++) {
+    pv_line[i] = 0.0f;
+  }
   for (int i = 0; i < PV_NUMCOMBS; i++) {
-    for (uint32_t j= 0; j < ctx->combl[i].bufsize; j++){
-      writeptr = ctx->combl[i].buf_base + j;
-      psram_write32(&psram_spi,writeptr << 3,(uint32_t)0);
+    for (uint32_t j = 0; j < ctx->combl[i].bufsize; j += PV_MAXBLOCK) {
+      psram_ring_write(ctx->combl[i].buf_base, ctx->combl[i].bufsize, j, pv_line, MIN(PV_MAXBLOCK, ctx->combl[i].bufsize - j));
     }
-    for (uint32_t j= 0; j < ctx->combr[i].bufsize; j++){
-      psram_write32(&psram_spi,(ctx->combr[i].buf_base+j) << 3,(uint32_t)0);
+#if PV_STEREO
+    for (uint32_t j = 0; j < ctx->combr[i].bufsize; j += PV_MAXBLOCK) {
+      psram_ring_write(ctx->combr[i].buf_base, ctx->combr[i].bufsize, j, pv_line, MIN(PV_MAXBLOCK, ctx->combr[i].bufsize - j));
     }
+#endif
   }
   for (int i = 0; i < PV_NUMALLPASSES; i++) {
-    for (uint32_t j= 0; j < ctx->allpassl[i].bufsize; j++){
-      psram_write32(&psram_spi,(ctx->allpassl[i].buf_base+j) << 3,(uint32_t)0);
+    for (uint32_t j = 0; j < ctx->allpassl[i].bufsize; j += PV_MAXBLOCK) {
+      psram_ring_write(ctx->allpassl[i].buf_base, ctx->allpassl[i].bufsize, j, pv_line, MIN(PV_MAXBLOCK, ctx->allpassl[i].bufsize - j));
     }
-    for (uint32_t j= 0; j < ctx->allpassr[i].bufsize; j++){
-      psram_write32(&psram_spi,(ctx->allpassr[i].buf_base+j) << 3,(uint32_t)0);
+#if PV_STEREO
+    for (uint32_t j = 0; j < ctx->allpassr[i].bufsize; j += PV_MAXBLOCK) {
+      psram_ring_write(ctx->allpassr[i].buf_base, ctx->allpassr[i].bufsize, j, pv_line, MIN(PV_MAXBLOCK, ctx->allpassr[i].bufsize - j));
     }
+#endif
   }
 }
 
@@ -176,27 +214,34 @@ static void update(pv_Context *ctx) {
 
   for (int i = 0; i < PV_NUMCOMBS; i++) {
     ctx->combl[i].feedback = ctx->roomsize1;
-    ctx->combr[i].feedback = ctx->roomsize1;
     comb_set_damp(&ctx->combl[i], ctx->damp1);
+#if PV_STEREO
+    ctx->combr[i].feedback = ctx->roomsize1;
     comb_set_damp(&ctx->combr[i], ctx->damp1);
+#endif
   }
 }
 
 void pv_set_samplerate(pv_Context *ctx, float value) {
   //const int combs[] = { 1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617 }; //44100Hz
-  const int combs[] = { 1215, 1293, 1390, 1476, 1548, 1623, 1695, 1760 };   //48000Hz
   //const int allpasses[] = { 556, 441, 341, 225 };   //44100Hz
-  const int allpasses[] = { 605, 480, 371, 245 };     //48000Hz
+  // 48000Hz line lengths for the selected PV_TOPOLOGY
+  const int combs[PV_NUMCOMBS] = PV_COMBLENGTHS;
+  const int allpasses[PV_NUMALLPASSES] = PV_ALLPASSLENGTHS;
   /* init comb buffers */
   for (int i = 0; i < PV_NUMCOMBS; i++) {
     ctx->combl[i].bufsize = combs[i];
+#if PV_STEREO
     ctx->combr[i].bufsize = (combs[i] + PV_STEREOSPREAD);
+#endif
   }
 
   /* init allpass buffers */
   for (int i = 0; i < PV_NUMALLPASSES; i++) {
     ctx->allpassl[i].bufsize = allpasses[i];
+#if PV_STEREO
     ctx->allpassr[i].bufsize = (allpasses[i] + PV_STEREOSPREAD);
+#endif
   }
 }
 
@@ -255,29 +300,90 @@ void pv_set_width(pv_Context *ctx, float value) {
 }
 
 /**
- * @brief Process an incoming L-R sample pair
+ * @brief Process a buffer of interleaved L-R sample pairs
+ * 
+ * The buffer is worked through in blocks of up to PV_MAXBLOCK frames. 
+ * Each comb and allpass filter reads its delay line for the whole block
+ * in bursts from PSRAM, then writes it back, rather than making a read and
+ * a write SPI transaction for every sample.
+ * 
+ * @param ctx pverb instance
+ * @param buf interleaved L-R samples, replaced by the output
+ * @param n number of samples in the buffer (2 per L-R pair)
  */
 void pv_process(pv_Context *ctx, float *buf, int n) {
-  for (int i = 0; i < n; i += 2) {
-    float outl = 0;
-    float outr = 0;
-    float input = (buf[i] + buf[i + 1]) * ctx->gain;
+  uint32_t start_cycles = cycle_count();
+  int frames = (n + 1) / 2;
+  pv_transactions = 0;
+  for (int start = 0; start < frames; start += PV_MAXBLOCK) {
+    int len = MIN(PV_MAXBLOCK, frames - start);
+    float *frame = &buf[start * 2];
+
+    for (int k = 0; k < len; k++) {
+      pv_input[k] = (frame[2 * k] + frame[2 * k + 1]) * ctx->gain;
+      pv_outl[k] = 0;
+      pv_outr[k] = 0;
+    }
 
     /* accumulate comb filters in parallel */
     for (int i = 0; i < PV_NUMCOMBS; i++) {
-      outl += comb_process(&ctx->combl[i], input);
-      //outr += comb_process(&ctx->combr[i], input);
+      comb_process(&ctx->combl[i], pv_input, pv_outl, len);
+#if PV_STEREO
+      comb_process(&ctx->combr[i], pv_input, pv_outr, len);
+#endif
     }
 
     /* feed through allpasses in series */
     for (int i = 0; i < PV_NUMALLPASSES; i++) {
-      outl = allpass_process(&ctx->allpassl[i], outl);
-      //outr = allpass_process(&ctx->allpassr[i], outr);
+      allpass_process(&ctx->allpassl[i], pv_outl, len);
+#if PV_STEREO
+      allpass_process(&ctx->allpassr[i], pv_outr, len);
+#endif
     }
 
     /* replace buffer with output */
-    buf[i  ] = outl * ctx->wet1 + outr * ctx->wet2 + buf[i  ] * ctx->dry;
-    buf[i+1] = outl * ctx->wet1 + outr * ctx->wet2 + buf[i+1] * ctx->dry;
-    //buf[i+1] = outr * ctx->wet1 + outl * ctx->wet2 + buf[i+1] * ctx->dry;
+    for (int k = 0; k < len; k++) {
+      float outl = pv_outl[k];
+#if PV_STEREO
+      float outr = pv_outr[k];
+#else
+      float outr = outl;
+#endif
+      frame[2 * k    ] = outl * ctx->wet1 + outr * ctx->wet2 + frame[2 * k    ] * ctx->dry;
+      frame[2 * k + 1] = outr * ctx->wet1 + outl * ctx->wet2 + frame[2 * k + 1] * ctx->dry;
+    }
   }
+  pv_Stats stats = {
+    .block_cycles = cycle_count() - start_cycles,
+    .block_transactions = pv_transactions,
+    .block_frames = frames
+  };
+  // publish for pv_report on core1, the same way as SharedParams
+  uint32_t seq = atomic_load_explicit(&ctx->stats_seq, memory_order_relaxed);
+  atomic_store_explicit(&ctx->stats_seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  ctx->stats = stats;
+  atomic_store_explicit(&ctx->stats_seq, seq + 2, memory_order_release);
+}
+
+/**
+ * @brief print the topology and the cost of the last block
+ * to the USB console
+ * 
+ * Called from core1 while core0 runs pv_process, so the stats are
+ * copied under their seqlock first. If core0 is part way through
+ * writing them nothing is printed, and the caller tries again later
+ * 
+ * @return true if the stats were printed
+ */
+bool pv_report(pv_Context *ctx) {
+  uint32_t seq = atomic_load_explicit(&ctx->stats_seq, memory_order_acquire);
+  if (seq & 1) return false;
+  pv_Stats stats = ctx->stats;
+  atomic_thread_fence(memory_order_acquire);
+  if (atomic_load_explicit(&ctx->stats_seq, memory_order_relaxed) != seq) return false;
+  printf("pverb %s: %d combs, %d allpasses, %s, %lu frames, %lu cycles, %lu SPI transactions per block\n",
+    PV_TOPOLOGY_NAME, PV_NUMCOMBS, PV_NUMALLPASSES, PV_STEREO ? "stereo" : "mono",
+    (unsigned long)stats.block_frames, (unsigned long)stats.block_cycles, (unsigned long)stats.block_transactions);
+  return true;
 }
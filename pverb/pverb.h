@@ -35,9 +35,45 @@ SOFTWARE.
 #define PVERB_H
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/**
+ * @brief pverb topologies
+ * 
+ * The structure of pverb is fixed at compile time by PV_TOPOLOGY, which
+ * can be set in CMakeLists.txt. Each topology sets the number of comb and 
+ * allpass lines, their lengths at 48kHz, the stereo spread and whether the
+ * right channel has its own set of lines.
+ * 
+ * PV_TOPOLOGY_LIGHT - 6 combs, 3 allpasses, mono (left lines only)
+ * PV_TOPOLOGY_FULL  - 8 combs, 4 allpasses, true stereo (freeverb)
+ */
+#define PV_TOPOLOGY_LIGHT 0
+#define PV_TOPOLOGY_FULL  1
+
+#ifndef PV_TOPOLOGY
+#define PV_TOPOLOGY       PV_TOPOLOGY_FULL
+#endif
+
+#if PV_TOPOLOGY == PV_TOPOLOGY_LIGHT
+#define PV_TOPOLOGY_NAME  "light"
+#define PV_NUMCOMBS       6
+#define PV_NUMALLPASSES   3
+#define PV_STEREO         0
+#define PV_COMBLENGTHS    { 1215, 1293, 1390, 1476, 1548, 1623 }
+#define PV_ALLPASSLENGTHS { 605, 480, 371 }
+#elif PV_TOPOLOGY == PV_TOPOLOGY_FULL
+#define PV_TOPOLOGY_NAME  "full"
+#define PV_NUMCOMBS       8
+#define PV_NUMALLPASSES   4
+#define PV_STEREO         1
+#define PV_COMBLENGTHS    { 1215, 1293, 1390, 1476, 1548, 1623, 1695, 1760 }
+#define PV_ALLPASSLENGTHS { 605, 480, 371, 245 }
+#else
+#error "Unknown PV_TOPOLOGY"
+#endif
 
-#define PV_NUMCOMBS       6   //8
-#define PV_NUMALLPASSES   3   //4
 #define PV_MUTED          0.0
 #define PV_FIXEDGAIN      0.015
 #define PV_SCALEWET       3.0
@@ -54,23 +90,33 @@ SOFTWARE.
 #define PV_INITIALMODE    0.0
 #define PV_INITIALSR      48000   // Is scaled to 48kHz in pv_set_sample_rate
 #define PV_FREEZEMODE     0.5
+#define PV_PSRAM_BASE     0x400000  // Byte address of the first pverb buffer - half-way up the PSRAM
+#define PV_LINE_BYTES     0x8000    // 8,192 samples per buffer - largest delay is 1783 samples, so more than adequate
+#define PV_MAXBLOCK       64        // Frames processed per burst. Must not exceed the shortest line
+#define PV_REPORT_INTERVAL 5000000  // uS between pverb stats reports on the USB console (PARROT_BENCHMARK only, 0 = off)
 
 typedef struct {
   float feedback;
   float filterstore;
   float damp1, damp2;
-  uint32_t buf_base;    // Base address of circular buffer
+  uint32_t buf_base;    // PSRAM byte address of circular buffer
   uint32_t bufsize;     // The length of the delay buffer in samples
   uint32_t bufidx;      // current read/write pointer
 } pv_Comb;
 
 typedef struct {
   float feedback;
-  uint32_t buf_base;    // Base address of circular buffer
+  uint32_t buf_base;    // PSRAM byte address of circular buffer
   uint32_t bufsize;     // The length of the delay buffer in samples
   uint32_t bufidx;      // current read/write pointer
 } pv_Allpass;
 
+typedef struct {
+  uint32_t block_cycles;        // CPU cycles taken by the last block
+  uint32_t block_transactions;  // PSRAM SPI transactions made by the last block
+  uint32_t block_frames;        // Number of frames in the last block
+} pv_Stats;
+
 typedef struct {
   float mode;
   float gain;
@@ -80,9 +126,13 @@ typedef struct {
   float dry;
   float width;
   pv_Comb combl[PV_NUMCOMBS];
-  pv_Comb combr[PV_NUMCOMBS];
   pv_Allpass allpassl[PV_NUMALLPASSES];
+#if PV_STEREO
+  pv_Comb combr[PV_NUMCOMBS];
   pv_Allpass allpassr[PV_NUMALLPASSES];
+#endif
+  pv_Stats stats;               // cost of the last block, written by core0 ...
+  _Atomic uint32_t stats_seq;   // ...under this seqlock - odd while it is being written
 } pv_Context;
 
 #include "../parrot.h"
@@ -98,5 +148,6 @@ void pv_set_damp(pv_Context *ctx, float value);
 void pv_set_wet(pv_Context *ctx, float value);
 void pv_set_dry(pv_Context *ctx, float value);
 void pv_set_width(pv_Context *ctx, float value);
+bool pv_report(pv_Context *ctx);
 
 #endif
@@ -0,0 +1,23 @@
+/**
+ * @file arm_math.h
+ * 
+ * Host stand-in for the few CMSIS-DSP calls that the code under test
+ * uses, written out as the plain loops they are equivalent to
+ */
+#ifndef ARM_MATH_H
+#define ARM_MATH_H
+
+#include <math.h>
+#include <stdint.h>
+
+typedef float float32_t;
+
+static inline void arm_scale_f32(const float32_t *src, float32_t scale, float32_t *dst, uint32_t n){
+    for (uint32_t i = 0; i < n; i++) dst[i] = src[i] * scale;
+}
+
+static inline void arm_copy_f32(const float32_t *src, float32_t *dst, uint32_t n){
+    for (uint32_t i = 0; i < n; i++) dst[i] = src[i];
+}
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @file test_euclid.c
+ * 
+ * Host test: regenerates every Euclidean pattern with bjorklund() and
+ * checks it against the precomputed EuclideanPatterns table, and that
+ * the right channel's rotation always gives it a pattern of its own
+ */
+#include <stdio.h>
+#include "parrot_euclid.h"
+
+int main(void){
+    int failures = 0;
+    for (int steps = 1; steps <= EUCLID_MAX_STEPS; steps++){
+        if (euclid_bit_pattern(steps, 0) != 0){
+            printf("steps %d fill 0: expected an empty pattern\n", steps);
+            failures++;
+        }
+        for (int fill = 1; fill <= steps; fill++){
+            unsigned int expected = bjorklund(steps, fill);
+            unsigned int table = euclid_bit_pattern(steps, fill);
+            if (table != expected){
+                printf("steps %d fill %d: table 0x%03X, bjorklund 0x%03X\n", steps, fill, table, expected);
+                failures++;
+            }
+            // rotated the way Euclidean_Plan does it, the right pattern
+            // should only match the left when every step is a hit
+            int rot = euclid_rotation(steps, fill);
+            unsigned int right = 0;
+            for (int step = 0; step < steps; step++){
+                int patternStep = (step + steps - rot) % steps;
+                if (bitRead(table, (steps - patternStep) - 1)) right |= 1u << ((steps - step) - 1);
+            }
+            if ((rot < 0) || (rot >= steps) || ((right == table) != (fill == steps))){
+                printf("steps %d fill %d: rotation %d gives right 0x%03X, left 0x%03X\n", steps, fill, rot, right, table);
+                failures++;
+            }
+        }
+        // fills beyond the number of steps are clamped
+        if (euclid_bit_pattern(steps, steps + 1) != euclid_bit_pattern(steps, steps)){
+            printf("steps %d: fill above steps is not clamped\n", steps);
+            failures++;
+        }
+    }
+    if ((euclid_bit_pattern(0, 1) != 0) || (euclid_bit_pattern(EUCLID_MAX_STEPS + 1, 1) != 0)){
+        printf("steps out of range: expected an empty pattern\n");
+        failures++;
+    }
+    printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file test_gverb_rings.c
+ *
+ * Host test: gverb_do with the power-of-two rings and masked indexes
+ * must give bit-identical output to the original modulo-indexed delay
+ * lines (exact length diffusers, fdnsize = maxdelay + 1000 and a 48000
+ * sample tap delay), run side by side on the same input
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gverb.h"
+
+#define TEST_RATE 48000
+#define TEST_FRAMES (6 * TEST_RATE)     // long enough for every line to wrap several times
+#define REF_TAPSIZE 48000
+
+/**
+ * @brief a delay line as it was before the power-of-two rings
+ */
+typedef struct {
+    int size;
+    int idx;
+    float *buf;
+} ref_delay;
+
+/**
+ * @brief the modulo-indexed state, coefficients come from the ty_gverb
+ */
+typedef struct {
+    ty_damper inputdamper;
+    ref_delay ldifs[4];
+    ref_delay rdifs[4];
+    ref_delay tapdelay;
+    float *fdnbuf;
+    int fdnsize;
+    int fdnidx;
+    float fdndampdelay[FDNORDER];
+} ref_gverb;
+
+static void ref_delay_init(ref_delay *d, int size){
+    d->size = size;
+    d->idx = 0;
+    d->buf = calloc(size, sizeof(float));
+}
+
+static float ref_diffuser_do(ref_delay *d, float coeff, float x){
+    float y,w;
+
+    w = x - d->buf[d->idx]*coeff;
+    w = flush_to_zero(w);
+    y = d->buf[d->idx] + w*coeff;
+    d->buf[d->idx] = w;
+    d->idx = (d->idx + 1) % d->size;
+    return(y);
+}
+
+static float ref_fixeddelay_read(ref_delay *d, int n){
+    return(d->buf[(d->idx - n + d->size) % d->size]);
+}
+
+static void ref_fixeddelay_write(ref_delay *d, float x){
+    d->buf[d->idx] = x;
+    d->idx = (d->idx + 1) % d->size;
+}
+
+static void ref_init(ref_gverb *r, const ty_gverb *p){
+    r->inputdamper = p->inputdamper;
+    for (int i = 0; i < 4; i++){
+        ref_delay_init(&r->ldifs[i], p->ldifs[i].size);
+        ref_delay_init(&r->rdifs[i], p->rdifs[i].size);
+    }
+    ref_delay_init(&r->tapdelay, REF_TAPSIZE);
+    r->fdnsize = (int)p->maxdelay + 1000;
+    r->fdnbuf = calloc(FDNORDER * r->fdnsize, sizeof(float));
+    r->fdnidx = 0;
+    memset(r->fdndampdelay, 0, sizeof(r->fdndampdelay));
+}
+
+/**
+ * @brief gverb_do as it is, but with the original modulo indexing
+ */
+static void ref_gverb_do(ref_gverb *r, const ty_gverb *p, float x, float *yl, float *yr){
+    float z;
+    unsigned int i;
+    float lsum,rsum,sum,sign;
+    float d[FDNORDER], u[FDNORDER], f[FDNORDER];
+
+    if ((x != x) || fabsf(x) > 100000.0f) {
+        x = 0.0f;
+    }
+
+    z = damper_do(&r->inputdamper, x);
+
+    z = ref_diffuser_do(&r->ldifs[0],p->ldifs[0].coeff,z);
+
+    for(i = 0; i < FDNORDER; i++) {
+        u[i] = p->tapgains[i]*ref_fixeddelay_read(&r->tapdelay,p->taps[i]);
+    }
+    ref_fixeddelay_write(&r->tapdelay,z);
+
+    for(i = 0; i < FDNORDER; i++) {
+        const float *line = r->fdnbuf + i*r->fdnsize;
+        float y = p->fdngains[i]*line[(r->fdnidx - p->fdnlens[i] + r->fdnsize) % r->fdnsize];
+
+        y = y*(1.0f-p->fdndamping) + r->fdndampdelay[i]*p->fdndamping;
+        r->fdndampdelay[i] = y;
+        d[i] = y;
+    }
+
+    sum = 0.0f;
+    sign = 1.0f;
+    for(i = 0; i < FDNORDER; i++) {
+        sum += sign*(p->taillevel*d[i] + p->earlylevel*u[i]);
+        sign = -sign;
+    }
+    sum += x*p->earlylevel;
+    lsum = sum;
+    rsum = sum;
+
+    gverb_fdnmatrix(d,f);
+
+    for(i = 0; i < FDNORDER; i++) {
+        r->fdnbuf[i*r->fdnsize + r->fdnidx] = u[i]+f[i];
+    }
+    r->fdnidx = (r->fdnidx + 1) % r->fdnsize;
+
+    for(i = 1; i < 4; i++) {
+        lsum = ref_diffuser_do(&r->ldifs[i],p->ldifs[i].coeff,lsum);
+    }
+    for(i = 1; i < 4; i++) {
+        rsum = ref_diffuser_do(&r->rdifs[i],p->rdifs[i].coeff,rsum);
+    }
+
+    *yl = lsum;
+    *yr = rsum;
+}
+
+/**
+ * @brief test input: noise bursts and isolated impulses, with silences
+ * long enough for the tail to decay through the lines
+ */
+static float test_input(int n){
+    static uint32_t seed = 12345;
+    seed = (seed * 1664525u) + 1013904223u;
+    int phase = n % TEST_RATE;
+    if (phase < 2400) return ((float)(seed >> 8) / 8388608.0f) - 1.0f;
+    if ((phase % 9600) == 5000) return 0.9f;
+    return 0.0f;
+}
+
+int main(void){
+    ty_gverb *p = gverb_new(TEST_RATE, GVERB_MAXROOMSIZE, GVERB_ROOMSIZE, 7.0f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f);
+    if (p == NULL){
+        printf("FAIL: gverb_new\n");
+        return 1;
+    }
+    ref_gverb r;
+    ref_init(&r, p);
+    int mismatches = 0;
+    float peak = 0.0f;
+    for (int n = 0; n < TEST_FRAMES; n++){
+        // change the decay and damping as it runs, as the pots would
+        if (n == 2 * TEST_RATE) gverb_set_revtime(p, 2.0f);
+        if (n == 3 * TEST_RATE) gverb_set_damping(p, 0.1f);
+        if (n == 4 * TEST_RATE) gverb_set_revtime(p, GVERB_MAXREVTIME);
+        float x = test_input(n);
+        float yl, yr, rl, rr;
+        gverb_do(p, x, &yl, &yr);
+        ref_gverb_do(&r, p, x, &rl, &rr);
+        if ((memcmp(&yl, &rl, sizeof(float)) != 0) || (memcmp(&yr, &rr, sizeof(float)) != 0)){
+            if (mismatches < 10) printf("frame %d: rings %.9g %.9g, modulo %.9g %.9g\n", n, yl, yr, rl, rr);
+            mismatches++;
+        }
+        if (fabsf(yl) > peak) peak = fabsf(yl);
+    }
+    // make sure the comparison wasn't between two silences
+    if (peak == 0.0f){
+        printf("FAIL: no output\n");
+        return 1;
+    }
+    printf("%s: %d of %d frames differ (peak %f)\n", mismatches ? "FAIL" : "PASS", mismatches, TEST_FRAMES, peak);
+    gverb_free(p);
+    return mismatches ? 1 : 0;
+}